@@ -11,6 +11,10 @@ Usage:
 Assumptions:
 - dose.vti stores energy deposition per voxel in keV.
 - Material density is taken from the first object in setups/setup.json.
+- If dose.vti has a "mass_g" array (per-voxel mass from the fraction of each
+  voxel inside every object mesh and its density), that mass is used and
+  empty voxels get zero dose; otherwise every voxel is assumed full of the
+  first object's material.
 
 Outputs (under output_prefix):
 - <prefix>_dose_Gy.npy   Dose per voxel (Gy)
@@ -61,6 +65,15 @@ def parse_vti(path: str):
     return values, (nx, ny, nz), origin, spacing
 
 
+def read_cell_array(path: str, name: str):
+    """Named CellData array as float64, or None if the VTI has no such array."""
+    root = ET.parse(path).getroot()
+    for array in root.findall(".//CellData/DataArray"):
+        if array.attrib.get("Name") == name and array.text is not None:
+            return np.array(array.text.split(), dtype=np.float64)
+    return None
+
+
 def write_vti(path: str, data: np.ndarray, dims: Tuple[int, int, int], origin, spacing, name="dose_Gy", metadata=None):
     nx, ny, nz = dims
     x0 = y0 = z0 = 0
@@ -133,7 +146,13 @@ def main():
     rho_kg_m3 = rho_g_cm3 * 1000.0
     voxel_mass_kg = voxel_volume_m3 * rho_kg_m3
 
-    dose_Gy = data_J / voxel_mass_kg  # J/kg
+    mass_g = read_cell_array(vti_path, "mass_g")
+    if mass_g is not None and mass_g.size == data_J.size:
+        mass_kg = mass_g * 1e-3
+        dose_Gy = np.divide(data_J, mass_kg, out=np.zeros_like(data_J), where=mass_kg > 0.0)
+    else:
+        mass_g = None
+        dose_Gy = data_J / voxel_mass_kg  # J/kg
 
     np.save(f"{prefix}_dose_Gy.npy", dose_Gy.astype(np.float32))
     meta = {
@@ -148,6 +167,8 @@ def main():
     print()
     print(f"rho                  : {rho_g_cm3:.3e} g/cm3")
     print(f"Voxel grid size      : {dims} mm")
+    if mass_g is not None:
+        print(f"Model mass           : {mass_g.sum():.3e} g (from mass_g)")
     print()
     print(f"Output directory     : {out_dir}")
     print(f"Output               : {prefix}_dose_Gy.npy, {prefix}_dose_Gy.vti")
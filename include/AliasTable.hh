@@ -0,0 +1,32 @@
+/*
+ * include/AliasTable.hh
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Walker alias table: draws index i with probability weights[i] / sum in
+// O(1) from one uniform number, whatever the number of entries
+class AliasTable {
+public:
+    AliasTable() = default;
+    explicit AliasTable(const std::vector<double>& weights);
+
+    // u uniform in [0, 1): its integer part picks a column, the fraction
+    // decides between the column and its alias
+    size_t Sample(double u) const
+    {
+        double x = u * double(prob.size());
+        size_t i = std::min(size_t(x), prob.size() - 1);
+        return x - double(i) < prob[i] ? i : alias[i];
+    }
+
+    bool Empty() const { return prob.empty(); }
+
+private:
+    std::vector<double> prob;     // chance of keeping column i
+    std::vector<uint32_t> alias;  // taken otherwise
+};
@@ -3,11 +3,20 @@
  */
 #pragma once
 
+#include "MeshVoxelizer.hh"
 #include "SceneConfig.hh"
+#include "STLLoader.hh"
 
+#include "G4ThreeVector.hh"
 #include "G4VUserDetectorConstruction.hh"
 #include "globals.hh"
 
+#include <cstdint>
+#include <vector>
+
+class G4LogicalVolume;
+class G4Material;
+
 class DetectorConstruction : public G4VUserDetectorConstruction {
 public:
     explicit DetectorConstruction(const SceneConfig& cfg)
@@ -15,7 +24,44 @@ public:
     ~DetectorConstruction() override = default;
 
     G4VPhysicalVolume* Construct() override;
+    void ConstructSDandField() override;
+
+    // Valid on the master after Construct(). Per voxel_grid cell: fraction
+    // filled by the objects and their mass in g (empty if not computed)
+    const std::vector<float>& Occupancy() const { return occupancy; }
+    const std::vector<float>& VoxelMass() const { return voxelMass; }
+    // Per object (SceneConfig::objects order), in mm3
+    const std::vector<double>& ObjectVolumes() const { return objectVolumes; }
+
+    // Box (mm, world frame) around all placed objects; false before
+    // Construct(). Shared with the workers' generators
+    bool ObjectBounds(G4ThreeVector& lo, G4ThreeVector& hi) const
+    {
+        lo = objectsLo;
+        hi = objectsHi;
+        return hasObjectBounds;
+    }
+
+    // Air box (mm, world frame) around the voxel cube and the objects of
+    // every instance, plus 1 mm: the scoring region. Nothing outside it is
+    // scored, so tracks leaving it are killed and rays missing it culled
+    static void ScoringEnvelope(const SceneConfig& cfg, G4ThreeVector& lo, G4ThreeVector& hi);
 
 private:
+    VoxelLayout GridLayout() const;
+    // gridCentre: position of the voxel grid centre in motherLV
+    void BuildPhantom(G4LogicalVolume* motherLV, const G4ThreeVector& gridCentre,
+                      const std::vector<STLMesh>& meshes,   // empty for primitives
+                      const G4ThreeVector& translation,
+                      G4Material* air, const std::vector<G4Material*>& objectMats);
+
     SceneConfig config;
+    std::vector<uint16_t> phantomMaterials;   // per-voxel index into {air, object materials...}
+    std::vector<float> occupancy;
+    std::vector<float> voxelMass;
+    std::vector<double> objectVolumes;
+    std::vector<const G4Material*> objectMaterials;
+    std::vector<G4LogicalVolume*> objectLVs;   // DoseSD is attached to these
+    G4ThreeVector objectsLo, objectsHi;
+    bool hasObjectBounds = false;
 };
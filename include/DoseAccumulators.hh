@@ -0,0 +1,81 @@
+/*
+ * include/DoseAccumulators.hh
+ * Per-voxel accumulator policies for DoseVoxelGrid<Acc>
+ *
+ * worker_type : cell type of the per-thread tiles
+ * shared_type : cell type of the shared grid and of the merged master grid
+ * kFlushDeposits : worker tiles are folded into the master grid after this
+ *                  many deposits (0 = only at end of run)
+ */
+
+#pragma once
+
+#include <cstdint>
+
+// Compensated float: running sum plus the rounding error it carries
+struct KahanFloat {
+    float sum = 0.0f;
+    float comp = 0.0f;
+};
+
+struct FloatAccumulator {
+    using worker_type = float;
+    using shared_type = float;
+    static constexpr const char* kName = "float";
+    static constexpr uint32_t kFlushDeposits = 0;
+
+    static void Add(float& cell, float v) { cell += v; }
+    static void Merge(float& dst, float src) { dst += src; }
+    static double Value(float cell) { return cell; }
+};
+
+struct DoubleAccumulator {
+    using worker_type = double;
+    using shared_type = double;
+    static constexpr const char* kName = "double";
+    static constexpr uint32_t kFlushDeposits = 0;
+
+    static void Add(double& cell, float v) { cell += v; }
+    static void Merge(double& dst, double src) { dst += src; }
+    static double Value(double cell) { return cell; }
+};
+
+struct KahanAccumulator {
+    using worker_type = KahanFloat;
+    using shared_type = KahanFloat;
+    static constexpr const char* kName = "kahan";
+    static constexpr uint32_t kFlushDeposits = 0;
+
+    // The rounding error of each add is carried into the next one, so the
+    // compensation stays below one ulp of the sum instead of stalling too
+    static void Add(KahanFloat& cell, float v)
+    {
+        float y = v - cell.comp;
+        float t = cell.sum + y;
+        cell.comp = (t - cell.sum) - y;
+        cell.sum = t;
+    }
+    static void Merge(KahanFloat& dst, const KahanFloat& src)
+    {
+        Add(dst, src.sum);
+        Add(dst, -src.comp);
+    }
+    static double Value(const KahanFloat& cell)
+    {
+        return double(cell.sum) - double(cell.comp);
+    }
+};
+
+// Float worker tiles, flushed into a double master grid before the float
+// partial sums grow large enough to swallow single keV deposits
+struct MixedAccumulator {
+    using worker_type = float;
+    using shared_type = double;
+    static constexpr const char* kName = "mixed";
+    static constexpr uint32_t kFlushDeposits = 4096;
+
+    static void Add(float& cell, float v) { cell += v; }
+    static void Add(double& cell, float v) { cell += v; }
+    static void Merge(double& dst, float src) { dst += src; }
+    static double Value(double cell) { return cell; }
+};
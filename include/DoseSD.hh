@@ -0,0 +1,52 @@
+/*
+ * include/DoseSD.hh
+ */
+#pragma once
+
+#include "KermaTable.hh"
+#include "SceneConfig.hh"
+
+#include "G4ThreeVector.hh"
+#include "G4VSensitiveDetector.hh"
+
+#include <memory>
+#include <vector>
+
+class G4Material;
+
+// Scores steps in the object volumes into the voxel grid and the
+// per-object tallies. Geant4 only calls it for steps that start inside an
+// object, so world steps cost nothing here. Instanced copies score into
+// their own grid replica, in the copy's local frame
+class DoseSD : public G4VSensitiveDetector {
+public:
+    // objectMaterials[i] is the material of SceneConfig::objects[i]
+    DoseSD(const G4String& name, const SceneConfig& cfg,
+           const std::vector<const G4Material*>& objectMaterials);
+    ~DoseSD() override = default;
+
+    G4bool ProcessHits(G4Step* step, G4TouchableHistory* history) override;
+
+private:
+    // Object index of a material, -1 if it belongs to none (phantom air)
+    int ObjectOf(const G4Material* material) const;
+
+    // World position of the grid origin for a replica; the phantom grid is
+    // always centred on the world origin
+    G4ThreeVector GridOffset(int replica) const
+    {
+        return phantom_ ? G4ThreeVector() : instanceOffsets_[replica];
+    }
+
+    // Photon fluence x mu_en along each step instead of analog deposits
+    void ScoreTrackLength(const G4Step* step, int object, int replica);
+
+    bool trackLength_ = false;
+    bool segment_ = false;   // split edep along pre -> post step
+    bool phantom_ = false;   // the volume is the voxel of a regular phantom
+    std::vector<int> objectOfMaterial_;   // by G4Material::GetIndex()
+    std::vector<G4ThreeVector> instanceOffsets_;   // by copy number
+    int numObjects_ = 0;
+    double maxEnergy_ = 0.0;
+    std::vector<std::unique_ptr<KermaTable>> kerma_;   // per object, built on first photon step
+};
@@ -1,29 +1,247 @@
-/* 
+/*
  * include/DoseVoxelGrid.hh
  */
 
 #pragma once
 
+#include "DoseAccumulators.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <string>
 #include <vector>
 #include "G4AutoLock.hh"
 
-class DoseVoxelGrid {
+// Accumulator-independent interface; the concrete DoseVoxelGrid<Acc> is
+// picked once from voxel_grid.precision and reached through Instance()
+class VoxelGrid {
 public:
-    static DoseVoxelGrid& Instance();
+    // "shared": one grid behind a mutex
+    // "thread_local": each worker fills private tiles, merged at end of run
+    // "atomic": one shared grid updated with lock-free compare-and-swap
+    enum class Mode { Shared, ThreadLocal, Atomic };
+
+    static VoxelGrid& Instance();
+    static Mode ParseMode(const std::string& name);
+
+    // precision: "float", "double", "kahan" or "mixed"
+    // uncertainty: score per-history sums of squares (thread_local only)
+    // batch: per-thread deposit buffer size, applied voxel-sorted when full
+    //        and at end of history (0 = write every deposit straight away)
+    // replicas: independent NX x NY x NZ maps over the same box, one per
+    //           instanced sample
+    static void Create(const std::string& precision,
+                       int NX, int NY, int NZ,
+                       float xmin, float ymin, float zmin,
+                       float dx, float dy, float dz,
+                       Mode mode = Mode::ThreadLocal,
+                       bool uncertainty = false,
+                       size_t batch = 0,
+                       int replicas = 1);
+
+    virtual ~VoxelGrid() = default;
+
+    // Positions are in the replica's own frame (the shared grid box)
+    virtual void AddEnergy(float x_mm, float y_mm, float z_mm, float edep_keV,
+                           int replica = 0) = 0;
+
+    // Deposit into a known voxel (e.g. a phantom copy number), no lookup
+    virtual void AddEnergyAt(int ix, int iy, int iz, float edep_keV, int replica = 0) = 0;
+
+    // Spread keV_per_mm * (path length in voxel) over every voxel the
+    // segment p0 -> p1 crosses (track-length scoring)
+    virtual void AddSegment(const double p0_mm[3], const double p1_mm[3],
+                            double keV_per_mm, int replica = 0) = 0;
+
+    // Per-object energy tally (object = index in SceneConfig::objects),
+    // kept per worker and summed into objectEnergy by Merge()
+    virtual void AddObjectEnergy(int object, double edep_keV) = 0;
+
+    // Close the calling worker's current history (one Geant4 event) and
+    // apply its buffered deposits
+    virtual void EndHistory() = 0;
+
+    // Fold worker tiles (or the atomic grid) into the master grid;
+    // call once workers are idle. Only the final merge frees the atomic
+    // grid, so a mid-run merge (convergence check) can keep scoring
+    virtual void Merge(bool final = true) = 0;
+
+    // Merged energy per voxel in keV; replica r fills entries
+    // [r * NX*NY*NZ, (r + 1) * NX*NY*NZ)
+    virtual std::vector<float> Energy() const = 0;
+
+    // The merged grid itself when it already holds float keV (float
+    // precision), so writers can skip the Energy() copy; nullptr otherwise
+    virtual const float* EnergyData() const = 0;
+
+    // Relative standard error of each voxel's energy (1 where nothing was
+    // deposited); empty unless uncertainty scoring is on
+    virtual std::vector<float> Uncertainty() const = 0;
 
-    void Initialize(int NX, int NY, int NZ,
-                    float xmin, float ymin, float zmin,
-                    float dx, float dy, float dz);
+    virtual const char* Precision() const = 0;
 
-    void AddEnergy(float x_mm, float y_mm, float z_mm, float edep_keV);
-    const std::vector<float>& Data() const { return grid; }
+    // Worker tiles are kTile^3 voxels, allocated on first deposit
+    static constexpr int kTileBits = 4;
+    static constexpr int kTile = 1 << kTileBits;
+    static constexpr int kTileVoxels = kTile * kTile * kTile;
 
     int NX, NY, NZ;
     float xmin, ymin, zmin;
     float dx, dy, dz;
+    Mode mode;
+    bool uncertainty;
+    size_t batch;
+    int replicas;
+    long long histories = 0;   // merged history count
+    std::vector<double> objectEnergy;   // merged keV per object
+
+protected:
+    VoxelGrid(int NX, int NY, int NZ,
+              float xmin, float ymin, float zmin,
+              float dx, float dy, float dz, Mode mode, bool uncertainty,
+              size_t batch, int replicas);
+
+    // Voxel indices of a point; false if it lies outside the grid
+    bool Locate(float x_mm, float y_mm, float z_mm, int& ix, int& iy, int& iz) const
+    {
+        ix = int((x_mm - xmin) / dx);
+        iy = int((y_mm - ymin) / dy);
+        iz = int((z_mm - zmin) / dz);
+        return ix >= 0 && ix < NX &&
+               iy >= 0 && iy < NY &&
+               iz >= 0 && iz < NZ;
+    }
+
+    // 3D DDA (Amanatides-Woo): visit(ix, iy, iz, length_mm) for each voxel
+    // the segment crosses, after clipping it to the grid box
+    template <typename Visit>
+    void Traverse(const double p0[3], const double p1[3], Visit&& visit) const
+    {
+        const int n[3] = {NX, NY, NZ};
+        const double lo[3] = {xmin, ymin, zmin};
+        const double d[3] = {dx, dy, dz};
+        double dir[3], t0 = 0.0, t1 = 1.0;
+        for (int a = 0; a < 3; ++a) {
+            dir[a] = p1[a] - p0[a];
+            double hi = lo[a] + n[a] * d[a];
+            if (dir[a] == 0.0) {
+                if (p0[a] < lo[a] || p0[a] >= hi) return;
+                continue;
+            }
+            double ta = (lo[a] - p0[a]) / dir[a];
+            double tb = (hi - p0[a]) / dir[a];
+            t0 = std::max(t0, std::min(ta, tb));
+            t1 = std::min(t1, std::max(ta, tb));
+        }
+        if (t0 >= t1) return;
+        const double len = std::sqrt(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+
+        // Start in the voxel holding the clipped entry point
+        int idx[3], step[3];
+        double tMax[3], tDelta[3];
+        const double inf = std::numeric_limits<double>::infinity();
+        for (int a = 0; a < 3; ++a) {
+            double p = p0[a] + t0 * dir[a];
+            idx[a] = std::min(n[a] - 1, std::max(0, int(std::floor((p - lo[a]) / d[a]))));
+            if (dir[a] > 0.0) {
+                step[a] = 1;
+                tMax[a] = (lo[a] + (idx[a] + 1) * d[a] - p0[a]) / dir[a];
+                tDelta[a] = d[a] / dir[a];
+            } else if (dir[a] < 0.0) {
+                step[a] = -1;
+                tMax[a] = (lo[a] + idx[a] * d[a] - p0[a]) / dir[a];
+                tDelta[a] = -d[a] / dir[a];
+            } else {
+                step[a] = 0;
+                tMax[a] = inf;
+                tDelta[a] = inf;
+            }
+        }
+
+        double t = t0;
+        while (t < t1) {
+            int a = (tMax[0] < tMax[1])
+                        ? (tMax[0] < tMax[2] ? 0 : 2)
+                        : (tMax[1] < tMax[2] ? 1 : 2);
+            double tNext = std::min(tMax[a], t1);
+            if (tNext > t)
+                visit(idx[0], idx[1], idx[2], (tNext - t) * len);
+            t = tNext;
+            if (t >= t1) break;
+            idx[a] += step[a];
+            if (idx[a] < 0 || idx[a] >= n[a]) break;
+            tMax[a] += tDelta[a];
+        }
+    }
+
+    int planes;       // z-planes stored: NZ per replica, stacked
+    int TX, TY, TZ;   // tiles per axis
+};
+
+template <typename Acc>
+class DoseVoxelGrid final : public VoxelGrid {
+public:
+    using worker_type = typename Acc::worker_type;
+    using shared_type = typename Acc::shared_type;
+
+    DoseVoxelGrid(int NX, int NY, int NZ,
+                  float xmin, float ymin, float zmin,
+                  float dx, float dy, float dz, Mode mode, bool uncertainty,
+                  size_t batch, int replicas);
+
+    void AddEnergy(float x_mm, float y_mm, float z_mm, float edep_keV,
+                   int replica) override;
+    void AddEnergyAt(int ix, int iy, int iz, float edep_keV, int replica) override;
+    void AddSegment(const double p0_mm[3], const double p1_mm[3],
+                    double keV_per_mm, int replica) override;
+    void AddObjectEnergy(int object, double edep_keV) override;
+    void EndHistory() override;
+    void Merge(bool final = true) override;
+    std::vector<float> Energy() const override;
+    const float* EnergyData() const override;
+    std::vector<float> Uncertainty() const override;
+    const char* Precision() const override { return Acc::kName; }
 
 private:
-    DoseVoxelGrid() = default;
-    std::vector<float> grid;
+    struct Tile {
+        worker_type cells[kTileVoxels] = {};
+        uint32_t deposits = 0;
+    };
+    // Buffered deposit, keyed by tile * kTileVoxels + cell (thread_local)
+    // or by linear voxel index (shared, atomic); iz counts stacked planes
+    struct Pending {
+        uint64_t key;
+        float edep;
+    };
+    struct TileSet {
+        std::vector<std::unique_ptr<Tile>> tiles;     // thread_local only
+        std::vector<std::unique_ptr<Tile>> squares;   // sum of squared histories
+        std::vector<Pending> pending;
+        std::vector<double> objects;   // keV per object
+        size_t allocated = 0;
+        long long histories = 0;
+    };
+
+    TileSet& LocalTiles();
+    void Deposit(int ix, int iy, int iz, float edep_keV);
+    void AddToTile(TileSet& local, uint64_t key, float edep_keV);
+    void AddToGrid(uint64_t key, float edep_keV);
+    void FlushPending(TileSet& local, bool squares);
+    Tile& GetTile(TileSet& local, std::vector<std::unique_ptr<Tile>>& tiles, size_t t);
+    void MergeTile(size_t t, Tile& tile, std::vector<shared_type>& dst);
+    void FlushTile(TileSet& local, size_t t);
+
+    std::vector<shared_type> grid;
+    std::vector<shared_type> grid2;   // merged sums of squares
+    // Atomic mode: the shared grid in blocks of kAtomicBlock cells, so the
+    // final merge can free each block as soon as it is copied
+    static constexpr int kAtomicBlockBits = 20;
+    static constexpr size_t kAtomicBlock = size_t(1) << kAtomicBlockBits;
+    std::vector<std::unique_ptr<std::atomic<shared_type>[]>> atomicGrid;
+    std::vector<std::unique_ptr<TileSet>> workerTiles;
+    static thread_local TileSet* tlsTiles;   // registered on first deposit
     G4Mutex mutex = G4MUTEX_INITIALIZER;
 };
@@ -0,0 +1,25 @@
+/*
+ * include/EnvelopeLimits.hh
+ */
+
+#pragma once
+
+#include "G4ThreeVector.hh"
+#include "G4UserLimits.hh"
+
+// Kill zone on the world volume: a track in the world whose straight path
+// misses the scoring envelope (ScoringPV) can only come back by scattering
+// in the air. Its minimum kinetic energy is then infinite, so
+// G4UserSpecialCuts stops it on its first world step instead of carrying
+// it to the world edge. Tracks heading for the envelope (the primaries)
+// are left alone. Nothing runs for steps inside the envelope
+class EnvelopeLimits : public G4UserLimits {
+public:
+    // Envelope box in world coordinates, Geant4 units
+    EnvelopeLimits(const G4ThreeVector& lo, const G4ThreeVector& hi);
+
+    G4double GetUserMinEkine(const G4Track& track) override;
+
+private:
+    G4ThreeVector lo, hi;
+};
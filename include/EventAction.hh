@@ -0,0 +1,15 @@
+/*
+ * include/EventAction.hh
+ */
+
+#pragma once
+
+#include "G4UserEventAction.hh"
+
+class EventAction : public G4UserEventAction {
+public:
+    EventAction() = default;
+    ~EventAction() override = default;
+
+    void EndOfEventAction(const G4Event* event) override;
+};
@@ -5,14 +5,24 @@
 
 #pragma once
 
+#include <cstddef>
 #include <vector>
 #include <string>
 #include <utility>
 
+// Named cell array, borrowed from the caller (NX*NY*NZ values, written
+// times scale); the first one written is the active scalar
+struct VTIField {
+    std::string name;
+    const float* data;
+    size_t size;
+    float scale = 1.0f;
+};
+
 class VTIWriter {
 public:
     static void Write(const std::string& filename,
-                      const std::vector<float>& data,
+                      const std::vector<VTIField>& fields,
                       int NX, int NY, int NZ,
                       float xmin, float ymin, float zmin,
                       float dx, float dy, float dz,
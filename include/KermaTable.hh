@@ -0,0 +1,24 @@
+/*
+ * include/KermaTable.hh
+ */
+
+#pragma once
+
+#include <vector>
+
+class G4Material;
+
+// Linear energy-absorption coefficient mu_en(E) of one material for
+// photons, tabulated from Geant4's cross sections (log-log interpolation)
+class KermaTable {
+public:
+    KermaTable(const G4Material* material, double emin, double emax, int bins = 400);
+
+    // mu_en in Geant4 internal units (1/mm) at photon energy E
+    double MuEn(double energy) const;
+
+private:
+    double logEmin = 0.0;
+    double invStep = 0.0;   // bins per unit log(E)
+    std::vector<double> logMuEn;
+};
@@ -0,0 +1,27 @@
+/*
+ * include/MeshCache.hh
+ */
+#pragma once
+
+#include "STLLoader.hh"
+
+#include <cstdint>
+#include <string>
+
+// Fitted meshes (vertices already scaled to mm) are cached next to the
+// source STL as <mesh>.<key>.meshcache and memory-mapped on later runs.
+// The key hashes the file content, the units and the fit target size, so
+// another mesh, unit or voxel box gets its own entry
+
+// 0 if the mesh cannot be read
+uint64_t MeshCacheKey(const std::string& meshPath, const std::string& units,
+                      double targetSize_mm);
+
+std::string MeshCachePath(const std::string& meshPath, uint64_t key);
+
+// false if the cache is missing, truncated or written for another key
+bool LoadMeshCache(const std::string& cachePath, uint64_t key,
+                   STLMesh& mesh, double& fitScale);
+
+bool SaveMeshCache(const std::string& cachePath, uint64_t key,
+                   const STLMesh& mesh, double fitScale);
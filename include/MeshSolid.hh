@@ -0,0 +1,96 @@
+/*
+ * include/MeshSolid.hh
+ */
+#pragma once
+
+#include "G4ThreeVector.hh"
+#include "G4VSolid.hh"
+
+#include <cstdint>
+#include <vector>
+
+// Closed triangle mesh solid navigated through a BVH. Leaves hold up to
+// four triangles stored lane-by-lane, so each ray test runs the four
+// Moller-Trumbore intersections as one vectorizable loop
+class MeshSolid : public G4VSolid {
+public:
+    // Three vertices per triangle, counter-clockwise seen from outside
+    MeshSolid(const G4String& name, const std::vector<G4ThreeVector>& triangles);
+    ~MeshSolid() override = default;
+
+    EInside Inside(const G4ThreeVector& p) const override;
+    G4ThreeVector SurfaceNormal(const G4ThreeVector& p) const override;
+
+    G4double DistanceToIn(const G4ThreeVector& p, const G4ThreeVector& v) const override;
+    G4double DistanceToIn(const G4ThreeVector& p) const override;
+    G4double DistanceToOut(const G4ThreeVector& p, const G4ThreeVector& v,
+                           const G4bool calcNorm = false,
+                           G4bool* validNorm = nullptr,
+                           G4ThreeVector* n = nullptr) const override;
+    G4double DistanceToOut(const G4ThreeVector& p) const override;
+
+    void BoundingLimits(G4ThreeVector& pMin, G4ThreeVector& pMax) const override;
+    G4bool CalculateExtent(const EAxis pAxis, const G4VoxelLimits& pVoxelLimit,
+                           const G4AffineTransform& pTransform,
+                           G4double& pMin, G4double& pMax) const override;
+
+    G4double GetCubicVolume() override;
+    G4double GetSurfaceArea() override;
+    G4ThreeVector GetPointOnSurface() const override;
+
+    G4GeometryType GetEntityType() const override { return "MeshSolid"; }
+    G4VSolid* Clone() const override { return new MeshSolid(*this); }
+    std::ostream& StreamInfo(std::ostream& os) const override;
+
+    void DescribeYourselfTo(G4VGraphicsScene& scene) const override;
+    G4Polyhedron* CreatePolyhedron() const override;
+
+    size_t NumTriangles() const { return normals.size(); }
+    size_t NumNodes() const { return nodes.size(); }
+
+private:
+    static constexpr int kLanes = 4;
+
+    // 32 bytes; float bounds are rounded outwards so they stay conservative
+    struct Node {
+        float bmin[3];
+        float bmax[3];
+        int32_t first;   // leaf: packet index; inner: left child (right = first + 1)
+        int32_t count;   // triangles in a leaf, 0 for inner nodes
+    };
+    // Leaf triangles as vertex a plus edges e1 = b - a, e2 = c - a
+    struct Packet {
+        double ax[kLanes], ay[kLanes], az[kLanes];
+        double e1x[kLanes], e1y[kLanes], e1z[kLanes];
+        double e2x[kLanes], e2y[kLanes], e2z[kLanes];
+        int32_t tri[kLanes];   // -1 for padding lanes
+    };
+
+    void Build(int index, std::vector<int>& order, int begin, int end,
+               const std::vector<G4ThreeVector>& centroids);
+
+    // Callback gets (triangle, t) for every ray hit with t in [tMin, tMax];
+    // it may shrink tMax to prune the rest of the traversal
+    template <typename OnHit>
+    void Intersect(const G4ThreeVector& p, const G4ThreeVector& v,
+                   double tMin, double& tMax, OnHit&& onHit) const;
+
+    // Nearest hit with n.v < 0 (sign -1, entering) or > 0 (sign +1, leaving)
+    double NearestHit(const G4ThreeVector& p, const G4ThreeVector& v,
+                      int sign, int* tri = nullptr) const;
+
+    // Distance to the surface, at least scale * exact; tri is the closest
+    // triangle found within maxDist (-1 and maxDist returned if none)
+    double Safety(const G4ThreeVector& p, double scale, double maxDist,
+                  int* tri = nullptr) const;
+
+    double BoxDistance(const G4ThreeVector& p) const;
+
+    std::vector<Node> nodes;
+    std::vector<Packet> packets;
+    std::vector<G4ThreeVector> vertices;   // 3 per triangle
+    std::vector<G4ThreeVector> normals;    // unit, outward
+    std::vector<double> cumulativeArea;
+    G4ThreeVector bmin, bmax;
+    double volume = -1.0;
+};
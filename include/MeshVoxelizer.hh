@@ -0,0 +1,31 @@
+/*
+ * include/MeshVoxelizer.hh
+ */
+#pragma once
+
+#include "G4ThreeVector.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Voxel grid the mesh is sampled on (same layout as VoxelGrid, in mm)
+struct VoxelLayout {
+    int NX, NY, NZ;
+    double xmin, ymin, zmin;
+    double dx, dy, dz;
+};
+
+// 1 for voxels whose centre lies inside the closed mesh, 0 otherwise,
+// indexed ix + NX*(iy + NY*iz). Triangles are 3 corners each, placed at
+// `offset`
+std::vector<uint8_t> VoxelizeMesh(const std::vector<G4ThreeVector>& triangles,
+                                 const G4ThreeVector& offset,
+                                 const VoxelLayout& grid);
+
+// Fraction of each voxel inside the closed mesh, indexed like VoxelizeMesh.
+// Every voxel is probed by samples x samples rays along x whose inside
+// length is clipped to the voxel exactly; z-planes are split over threads
+std::vector<float> MeshOccupancy(const std::vector<G4ThreeVector>& triangles,
+                                 const G4ThreeVector& offset,
+                                 const VoxelLayout& grid, int samples);
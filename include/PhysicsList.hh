@@ -4,10 +4,14 @@
 
 #pragma once
 
+#include "SceneConfig.hh"
+
 #include "G4VModularPhysicsList.hh"
 
 class PhysicsList : public G4VModularPhysicsList {
 public:
-    PhysicsList();
+    // The world gets physics.world_cut_mm; the scoring region sets its own
+    // cuts in DetectorConstruction
+    explicit PhysicsList(const PhysicsConfig& cfg);
     ~PhysicsList() override = default;
 };
@@ -4,10 +4,13 @@
 
 #pragma once
 
+#include "AliasTable.hh"
 #include "SceneConfig.hh"
 
+#include "G4ThreeVector.hh"
 #include "G4VUserPrimaryGeneratorAction.hh"
 #include <atomic>
+#include <vector>
 
 class G4ParticleGun;
 
@@ -20,8 +23,61 @@ public:
 
     static void SetEventOffset(long long offset);
 
+    // Primaries whose ray misses the scoring envelope, over all runs; their
+    // events stay empty but still count as histories
+    static long long CulledPrimaries();
+
 private:
+    enum class Beam { Parallel, Point };
+    // How the global event id picks a projection angle
+    enum class Schedule { Fixed, Step, StepInterleaved, Fly, FlyInterleaved };
+
+    // Beamline frame at one projection angle, plus the part of the
+    // footprint (u, v on the sampling plane) that can reach the objects
+    // and the photon weight area(window) / area(footprint)
+    struct Pose {
+        G4ThreeVector src, det, dir, u_hat, v_hat;
+        double u0, du, v0, dv;   // window in mm
+        double weight;
+    };
+
+    // Fills poses for every angle the schedule can produce (fly: a table
+    // at acquisition.fly_step_deg); needs the detector, so it runs on the
+    // first event
+    void BuildPoses();
+    Pose MakePose(double angle_deg) const;
+
+    // Sampling kernel per beam type and schedule: for each of the event's
+    // photons a pose lookup, two random numbers (three with a spectrum,
+    // drawn for the whole event at once), the cull test and one primary
+    // vertex
+    template <Beam B, Schedule S>
+    void Shoot(G4Event* event);
+    // photonId = global event id * photons_per_event + photon in the event
+    template <Schedule S>
+    size_t PoseIndex(long long photonId) const;
+    template <Beam B>
+    void SelectKernel(Schedule schedule);
+
+    // Ray from p along d (unit) never enters the scoring envelope
+    bool Misses(const G4ThreeVector& p, const G4ThreeVector& d) const;
+
+    // Objects' box projected on the sampling plane (at the source for a
+    // parallel beam, the detector plane for a point source), clipped to
+    // the sx x sy footprint; sets u0/du/v0/dv and weight of the pose
+    void Silhouette(Pose& pose, double sx, double sy) const;
+
     SceneConfig config;
     G4ParticleGun* fParticleGun;
+    G4ThreeVector envelopeLo, envelopeHi;   // in Geant4 units
+    std::vector<Pose> poses;
+    long long photonsPerProjection = 1;     // Schedule::Step
+    long long totalPhotons = 0;             // Schedule::Fly
+    std::vector<double> randoms;            // randomsPerPhoton per photon of the event
+    int randomsPerPhoton = 2;               // u, v (+ energy with a spectrum)
+    std::vector<double> energies;           // spectrum lines in Geant4 units
+    AliasTable spectrum;                    // built once per thread
+    void (PrimaryGeneratorAction::*kernel)(G4Event*) = nullptr;
     static std::atomic<long long> eventOffset;
+    static std::atomic<long long> culled;
 };
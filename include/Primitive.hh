@@ -0,0 +1,38 @@
+/*
+ * include/Primitive.hh
+ */
+#pragma once
+
+#include "MeshVoxelizer.hh"
+#include "SceneConfig.hh"
+
+#include "G4ThreeVector.hh"
+#include "globals.hh"
+
+#include <vector>
+
+class G4RotationMatrix;
+class G4VSolid;
+
+// Analytic objects (box, cylinder, capillary, sphere) built as native
+// Geant4 solids, so navigation needs no facets. All lengths are in mm in
+// the grid frame; cylinders run along z before PrimitiveRotation
+
+G4VSolid* BuildPrimitiveSolid(const G4String& name, const PrimitiveConfig& p);
+
+// Rotation placing the solid's z axis on p.axis (nullptr for z); the
+// shapes are symmetric, so the sense of rotation does not matter
+G4RotationMatrix* PrimitiveRotation(const PrimitiveConfig& p);
+
+bool PrimitiveContains(const PrimitiveConfig& p, const G4ThreeVector& point_mm);
+
+// Exact volume in mm3
+double PrimitiveVolume(const PrimitiveConfig& p);
+
+void PrimitiveBounds(const PrimitiveConfig& p, G4ThreeVector& lo, G4ThreeVector& hi);
+
+// Fraction of each voxel inside the shape, indexed like MeshOccupancy,
+// from samples^3 points per voxel (1: 0/1 by voxel centre). Only voxels
+// overlapping the bounds are probed; z-planes are split over threads
+std::vector<float> PrimitiveOccupancy(const PrimitiveConfig& p, const VoxelLayout& grid,
+                                      int samples);
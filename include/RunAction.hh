@@ -20,6 +20,13 @@ public:
     static void SetIsFinalChunk(bool v);
     static bool IsFinalChunk();
 
+    // Set by the master once the convergence target is met
+    static bool IsConverged();
+    static long long SimulatedEvents();
+
+    // Physical photons per simulated history applied to the written tallies
+    static double HistoryWeight();
+
 private:
     SceneConfig config;
 };
@@ -0,0 +1,42 @@
+/*
+ * include/STLLoader.hh
+ */
+#pragma once
+
+#include "G4ThreeVector.hh"
+
+#include <string>
+#include <vector>
+
+// Triangles of an STL file, read once and shared by the bounds/fit code,
+// CADMesh and the BVH/voxel geometries
+struct STLMesh {
+    std::vector<float> vertices;   // 9 per triangle: a, b, c
+    std::vector<float> normals;    // 3 per triangle, unit (zero if degenerate)
+    G4ThreeVector min, max;
+    bool ok = false;
+
+    size_t NumTriangles() const { return normals.size() / 3; }
+
+    // Multiply vertices and bounds by scale (> 0)
+    void Scale(double scale);
+
+    // Corners multiplied by scale, 3 per triangle
+    std::vector<G4ThreeVector> Corners(double scale) const;
+};
+
+// Read-only mapping of a whole file (data is null if it cannot be mapped),
+// unmapped on scope exit
+struct MappedFile {
+    const char* data = nullptr;
+    size_t size = 0;
+
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+};
+
+// Memory-maps the file; binary STL is parsed in parallel chunks, ASCII in
+// one pass over the mapping. ok is false if the file cannot be read
+STLMesh LoadSTL(const std::string& path);
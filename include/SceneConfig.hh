@@ -4,6 +4,7 @@
  */
 #pragma once
 #include <string>
+#include <vector>
 #include <array>
 
 struct BeamConfig {
@@ -13,9 +14,15 @@ struct BeamConfig {
     std::array<double,3> detector_up;
     std::array<int,2>    detector_pixels;
     std::array<double,2> detector_pixel_size_mm;
-    double mono_energy_keV;
+    double mono_energy_keV;               // optional with a spectrum (defaults to its mean)
+    std::vector<double> spectrum_keV;     // polychromatic lines; empty = mono_energy_keV
+    std::vector<double> spectrum_weight;  // relative intensity of each line
+    std::string spectrum_source;          // file path, or "inline"
     double photon_flux_per_s;
     double exposure_time_s;
+    long long histories = 0;              // simulated histories; 0 = one per physical photon
+    std::string footprint = "full";       // "full" detector area, or only the objects' projected box (weighted)
+    int photons_per_event = 1;            // primaries per Geant4 event (one history)
 };
 
 struct ObjectMaterial {
@@ -24,10 +31,25 @@ struct ObjectMaterial {
     double cp_J_kgK;
 };
 
+// Analytic shape placed instead of a mesh, in mm in the grid frame (not
+// scaled by the mesh fit)
+struct PrimitiveConfig {
+    std::string type;                     // "box", "cylinder", "capillary" or "sphere"; empty = mesh
+    std::array<double,3> size_mm = {0.0, 0.0, 0.0};       // box edges
+    double radius_mm = 0.0;               // outer radius
+    double length_mm = 0.0;               // cylinder / capillary length along axis
+    double wall_mm = 0.0;                 // > 0: hollow shell (capillary: open tube, required)
+    char axis = 'z';                      // cylinder / capillary axis
+    std::array<double,3> position_mm = {0.0, 0.0, 0.0};   // centre
+};
+
 struct ObjectConfig {
     std::string id;
+    PrimitiveConfig primitive;
     std::string mesh_path;
     std::string units;        // "mm"
+    std::string geometry = "mesh";   // "mesh" (G4TessellatedSolid), "bvh" (MeshSolid) or "voxel" (regular phantom, whole scene; first object only)
+    bool mesh_cache = true;          // keep the fitted mesh in <mesh>.<key>.meshcache
     ObjectMaterial material;
 };
 
@@ -36,6 +58,22 @@ struct VoxelGridConfig {
     int ny = 100;
     int nz = 100;
     double half_size_mm = 10.0; // Cube half-length; default [-10, +10] mm
+    std::string accumulation = "thread_local"; // "thread_local" (tiled), "atomic" or "shared" (mutex)
+    std::string precision = "float";           // "float", "double", "kahan" or "mixed"
+    bool uncertainty = false;                  // per-voxel relative uncertainty map
+    std::string scoring = "edep";              // "edep" (analog) or "track_length" (photon kerma)
+    int batch = 0;                             // per-thread deposit buffer entries (0 = direct)
+    std::string deposit = "point";             // edep into the pre-step voxel, or "segment" (split along the step)
+    int occupancy_samples = 0;                 // rays per voxel edge for the occupancy field (0 = off)
+};
+
+// Production cuts inside the scoring envelope (the grid box around every
+// instance) and in the rest of the world, which is only air
+struct PhysicsConfig {
+    double cut_mm = 0.1;                  // G4Region "ScoringRegion"
+    double world_cut_mm = 0.1;            // default cut everywhere else
+    bool kill_outside = false;            // stop world tracks whose path misses the envelope
+    bool cull_primaries = false;          // skip primaries whose ray misses the envelope
 };
 
 struct AcquisitionConfig {
@@ -45,14 +83,35 @@ struct AcquisitionConfig {
     double end_angle_deg   = 360.0;
     std::array<double,3> rotation_axis    = {0.0, 0.0, 1.0};   // axis in world coords
     std::array<double,3> rotation_center_mm = {0.0, 0.0, 0.0}; // pivot point
-    long long total_events = 0;           // intended total events across all chunks
+    long long total_events = 0;           // intended total events across all chunks (x photons_per_event photons)
+    long long target_photons = 0;         // photons asked for, before rounding up to whole events
+    bool interleave = false;              // spread every chunk over all angles (open-ended runs)
+    double fly_step_deg = 0.05;           // fly mode: angle table resolution (nearest entry is used)
+};
+
+// Stop the event loop once the dose estimate is good enough
+struct ConvergenceConfig {
+    bool   enabled = false;
+    double target_rel_uncertainty = 0.0;  // per-voxel relative standard error to reach
+    double dose_threshold = 0.1;          // region: voxels above this fraction of max edep
+    double coverage = 0.95;               // fraction of region voxels that must reach target
+    bool   has_roi = false;               // optionally restrict the region to a box
+    std::array<double,3> roi_min_mm = {0.0, 0.0, 0.0};
+    std::array<double,3> roi_max_mm = {0.0, 0.0, 0.0};
+    long long check_every_events = 1000000;
+    long long max_events = 0;             // 0 = flux * exposure
 };
 
 struct SceneConfig {
     BeamConfig beam;
-    ObjectConfig object;
+    std::vector<ObjectConfig> objects;   // disjoint meshes, one material and tally each
+    // Copies of the whole object set (e.g. a tray of identical samples),
+    // offset from the fitted scene; each copy scores into its own dose map
+    std::vector<std::array<double,3>> instances_mm = {{0.0, 0.0, 0.0}};
     VoxelGridConfig voxel_grid;
+    PhysicsConfig physics;
     AcquisitionConfig acquisition;
+    ConvergenceConfig convergence;
     std::string config_dir;    // Absolute directory containing the config file
     std::string output_dir;    // Where to store simulation outputs
 
@@ -53,7 +53,7 @@ SETUPS=(
     
     "setups/setup_grid_10.json"
     "setups/setup_grid_100.json"
-    #"setups/setup_grid_1000.json"
+    "setups/setup_grid_1000.json"
     
     "setups/setup_material_bone.json"
     "setups/setup_material_ethanol.json"
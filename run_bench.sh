@@ -0,0 +1,117 @@
+#!/bin/bash
+
+#SBATCH --job-name=run_bench
+#SBATCH --partition=vera
+#SBATCH --nodes=1
+#SBATCH --ntasks=1
+#SBATCH --cpus-per-task=32
+#SBATCH --time=03:00:00
+
+#SBATCH --output=log_bench.out
+#SBATCH --open-mode=truncate
+
+#SBATCH --account=c3se2026-1-16
+
+set -euo pipefail
+
+module purge
+module load GCCcore/13.2.0 
+module load CMake/3.27.6-GCCcore-13.2.0 
+module load Geant4/11.3.0-GCC-13.2.0 
+module load assimp/5.3.1-GCCcore-13.2.0 
+
+cd "$SLURM_SUBMIT_DIR"
+
+rm -f build/CMakeCache.txt
+cmake -S . -B build 
+cmake --build build -j "${SLURM_CPUS_PER_TASK:-32}"
+
+mkdir -p output/bench
+
+# Fixed event count so every point does the same work
+EVENTS="${BENCH_EVENTS:-2000000}"
+THREADS=(1 2 4 8 16 32)
+
+# Voxel grid accumulation backends to compare
+SETUPS=(
+    "setups/setup_bench_shared.json"
+    "setups/setup_bench_thread_local.json"
+    "setups/setup_bench_atomic.json"
+    # Direct vs batched (voxel-sorted) deposits, uncertainty off
+    "setups/setup_bench_direct_100.json"
+    "setups/setup_bench_batch_100.json"
+    "setups/setup_bench_direct_1000.json"
+    "setups/setup_bench_batch_1000.json"
+    # G4TessellatedSolid vs BVH MeshSolid on the same mesh
+    "setups/setup_bench_mesh_tessellated.json"
+    "setups/setup_bench_mesh_bvh.json"
+    # Mostly world-air steps (full footprint, no culling or killing): the
+    # per-step cost outside the model
+    "setups/setup_bench_world_steps.json"
+)
+
+summary="output/bench/bench_scaling.csv"
+echo "setup,threads,events,loop_s,events_per_s" > "$summary"
+
+failed_runs=()
+
+for cfg in "${SETUPS[@]}"; do
+  base=$(basename "$cfg" .json)
+
+  for n in "${THREADS[@]}"; do
+    log="output/bench/${base}_t${n}.log"
+    echo "[bench] ${cfg} with ${n} threads"
+
+    if ! G4NUM_THREADS="$n" srun build/run --events "$EVENTS" --setup "$cfg" > "$log"; then
+      echo "[bench] FAILED ${cfg} with ${n} threads"
+      failed_runs+=("${cfg}:t${n}")
+      continue
+    fi
+
+    loop_s=$(awk -F': ' '/^Event loop time/ {print $2+0}' "$log")
+    rate=$(awk -F': ' '/^Event rate/ {print $2+0}' "$log")
+    echo "${base},${n},${EVENTS},${loop_s},${rate}" >> "$summary"
+  done
+done
+
+# Optional before/after: BENCH_BASELINE_REV (e.g. the commit before the
+# sensitive-detector scoring) is built in a worktree and runs the world-step
+# setup next to the current build; its rows are tagged with the revision
+if [ -n "${BENCH_BASELINE_REV:-}" ]; then
+  baseline_src="build_baseline/src"
+  rm -rf build_baseline
+  git worktree prune
+  git worktree add --detach "$baseline_src" "$BENCH_BASELINE_REV"
+  cmake -S "$baseline_src" -B build_baseline/build
+  cmake --build build_baseline/build -j "${SLURM_CPUS_PER_TASK:-32}"
+
+  cfg="setups/setup_bench_world_steps.json"
+  base=$(basename "$cfg" .json)
+  for n in "${THREADS[@]}"; do
+    log="output/bench/${base}_baseline_t${n}.log"
+    echo "[bench] ${cfg} at ${BENCH_BASELINE_REV} with ${n} threads"
+
+    if ! G4NUM_THREADS="$n" srun build_baseline/build/run --events "$EVENTS" --setup "$cfg" > "$log"; then
+      echo "[bench] FAILED ${cfg} at ${BENCH_BASELINE_REV} with ${n} threads"
+      failed_runs+=("${cfg}@${BENCH_BASELINE_REV}:t${n}")
+      continue
+    fi
+
+    loop_s=$(awk -F': ' '/^Event loop time/ {print $2+0}' "$log")
+    rate=$(awk -F': ' '/^Event rate/ {print $2+0}' "$log")
+    echo "${base}@${BENCH_BASELINE_REV},${n},${EVENTS},${loop_s},${rate}" >> "$summary"
+  done
+
+  git worktree remove --force "$baseline_src"
+fi
+
+column -s, -t "$summary"
+
+if [ "${#failed_runs[@]}" -gt 0 ]; then
+  echo "[bench] Failed runs summary:"
+  for item in "${failed_runs[@]}"; do
+    echo "  - ${item}"
+  done
+else
+  echo "[bench] All runs completed successfully."
+fi
@@ -1,12 +1,12 @@
 /* 
  * src/ActionInitialization.cc
- * Wires primary generation, run and stepping actions
+ * Wires primary generation, run and event actions
  */
 
 #include "ActionInitialization.hh"
+#include "EventAction.hh"
 #include "PrimaryGeneratorAction.hh"
 #include "RunAction.hh"
-#include "SteppingAction.hh"
 
 void ActionInitialization::Build() const
 {
@@ -14,7 +14,9 @@ void ActionInitialization::Build() const
     
     SetUserAction(new RunAction(config));
     
-    SetUserAction(new SteppingAction(config.output_dir));
+    SetUserAction(new EventAction());
+
+    // Scoring lives in DoseSD (DetectorConstruction::ConstructSDandField)
 }
 
 void ActionInitialization::BuildForMaster() const
@@ -0,0 +1,40 @@
+/*
+ * src/AliasTable.cc
+ * Vose's construction of the Walker alias table
+ */
+
+#include "AliasTable.hh"
+
+#include <numeric>
+
+AliasTable::AliasTable(const std::vector<double>& weights)
+{
+    const size_t n = weights.size();
+    double sum = std::accumulate(weights.begin(), weights.end(), 0.0);
+    if (n == 0 || sum <= 0.0) return;
+
+    // Scale so the mean column is 1, then pair every short column with a
+    // long one that tops it up
+    std::vector<double> scaled(n);
+    std::vector<uint32_t> small, large;
+    for (size_t i = 0; i < n; ++i) {
+        scaled[i] = weights[i] * double(n) / sum;
+        (scaled[i] < 1.0 ? small : large).push_back(uint32_t(i));
+    }
+    prob.assign(n, 1.0);
+    alias.resize(n);
+    for (size_t i = 0; i < n; ++i) alias[i] = uint32_t(i);
+
+    while (!small.empty() && !large.empty()) {
+        uint32_t s = small.back(), l = large.back();
+        small.pop_back();
+        prob[s] = scaled[s];
+        alias[s] = l;
+        scaled[l] -= 1.0 - scaled[s];
+        if (scaled[l] < 1.0) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // Leftovers are 1 up to rounding; prob stays 1 for them
+}
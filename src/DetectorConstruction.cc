@@ -4,6 +4,13 @@
  */
 
 #include "DetectorConstruction.hh"
+#include "DoseSD.hh"
+#include "EnvelopeLimits.hh"
+#include "MeshCache.hh"
+#include "MeshSolid.hh"
+#include "MeshVoxelizer.hh"
+#include "Primitive.hh"
+#include "STLLoader.hh"
 #include "CADMesh.hh"
 
 #include <memory>
@@ -12,90 +19,67 @@
 #include "G4NistManager.hh"
 #include "G4LogicalVolume.hh"
 #include "G4PVPlacement.hh"
+#include "G4PVParameterised.hh"
+#include "G4PhantomParameterisation.hh"
+#include "G4ProductionCuts.hh"
+#include "G4Region.hh"
+#include "G4RotationMatrix.hh"
 #include "G4SystemOfUnits.hh"
-#include "G4MultiFunctionalDetector.hh"
 #include "G4SDManager.hh"
-#include "G4PSDoseDeposit.hh"
 
 #include <cctype>
 #include <algorithm>
-#include <fstream>
+#include <chrono>
+#include <cmath>
+#include <limits>
 #include <map>
 #include <stack>
 
 
 namespace {
-struct STLBounds {
-    bool ok = false;
-    G4ThreeVector min;
-    G4ThreeVector max;
+// Hands an STLMesh that is already in memory to CADMesh, so the file is
+// not parsed a second time (by Assimp)
+class STLMeshReader : public CADMesh::File::Reader {
+public:
+    explicit STLMeshReader(const STLMesh& mesh)
+        : Reader("STLMeshReader"), mesh(mesh) {}
+
+    G4bool Read(G4String) override
+    {
+        CADMesh::Triangles triangles;
+        triangles.reserve(mesh.NumTriangles());
+        auto corners = mesh.Corners(1.0);
+        for (size_t i = 0; i + 2 < corners.size(); i += 3)
+            triangles.push_back(new G4TriangularFacet(corners[i], corners[i + 1],
+                                                      corners[i + 2], ABSOLUTE));
+        AddMesh(CADMesh::Mesh::New(triangles, "Model"));
+        return true;
+    }
+    G4bool CanRead(CADMesh::File::Type) override { return true; }
+
+private:
+    const STLMesh& mesh;
 };
 
-// Read a binary STL (and fall back to ASCII) to estimate bounds.
-STLBounds ComputeSTLBounds(const std::string& path)
-{
-    STLBounds b;
-    std::ifstream f(path, std::ios::binary);
-    if (!f) return b;
-
-    f.seekg(0, std::ios::end);
-    std::streamsize fileSize = f.tellg();
-    f.seekg(0, std::ios::beg);
-
-    char header[80];
-    f.read(header, 80);
-
-    uint32_t nTriangles = 0;
-    f.read(reinterpret_cast<char*>(&nTriangles), sizeof(uint32_t));
-
-    std::streamsize expectedSize = 84 + static_cast<std::streamsize>(nTriangles) * 50;
-    auto accumulateVertex = [&](double x, double y, double z) {
-        if (!b.ok) {
-            b.min = {x, y, z};
-            b.max = {x, y, z};
-            b.ok = true;
-        } else {
-            b.min.setX(std::min(b.min.x(), x));
-            b.min.setY(std::min(b.min.y(), y));
-            b.min.setZ(std::min(b.min.z(), z));
-            b.max.setX(std::max(b.max.x(), x));
-            b.max.setY(std::max(b.max.y(), y));
-            b.max.setZ(std::max(b.max.z(), z));
-        }
-    };
+// G4PhantomParameterisation stores material indices as size_t (8 GB at
+// 1000^3); this one reads 16-bit indices, which also serve the regular
+// navigation since it asks ComputeMaterial for every voxel
+class CompactPhantomParameterisation : public G4PhantomParameterisation {
+public:
+    CompactPhantomParameterisation(const std::vector<G4Material*>& materials,
+                                   const uint16_t* indices)
+        : materials(materials), indices(indices) {}
 
-    if (fileSize >= expectedSize) {
-        // Likely binary STL
-        for (uint32_t i = 0; i < nTriangles && f; ++i) {
-            float normal[3];
-            float verts[9];
-            uint16_t attr;
-            f.read(reinterpret_cast<char*>(normal), sizeof(normal));
-            f.read(reinterpret_cast<char*>(verts), sizeof(verts));
-            f.read(reinterpret_cast<char*>(&attr), sizeof(attr));
-            for (int v = 0; v < 3; ++v) {
-                double x = verts[3*v + 0];
-                double y = verts[3*v + 1];
-                double z = verts[3*v + 2];
-                accumulateVertex(x, y, z);
-            }
-        }
-        if (b.ok) return b;
-    }
-
-    // Fallback: ASCII parser
-    f.clear();
-    f.seekg(0, std::ios::beg);
-    std::string word;
-    while (f >> word) {
-        if (word == "vertex") {
-            double x, y, z;
-            f >> x >> y >> z;
-            accumulateVertex(x, y, z);
-        }
+    G4Material* ComputeMaterial(const G4int copyNo, G4VPhysicalVolume*,
+                                const G4VTouchable*) override
+    {
+        return materials[indices[copyNo]];
     }
-    return b;
-}
+
+private:
+    std::vector<G4Material*> materials;
+    const uint16_t* indices;
+};
 
 // Tiny chemical formula expander (supports parentheses and integer counts)
 // Returns element -> atom count
@@ -137,12 +121,93 @@ static std::map<std::string, int> ExpandFormula(const std::string& f)
     }
     return st.top();
 }
+
+// Material from the object's chemical formula, named <id>Mat
+G4Material* BuildMaterial(const ObjectConfig& obj)
+{
+    // Reuse if already constructed (Geant4 keeps a materials table)
+    G4String name = obj.id + "Mat";
+    if (auto* existing = G4Material::GetMaterial(name, false))
+        return existing;
+
+    auto* nist = G4NistManager::Instance();
+    auto atoms = ExpandFormula(obj.material.formula);
+    auto* m = new G4Material(name, obj.material.density_g_cm3 * g/cm3, atoms.size());
+    for (const auto& kv : atoms) {
+        auto* el = nist->FindOrBuildElement(kv.first);
+        m->AddElement(el, kv.second);
+    }
+    return m;
+}
+
+// Mesh of one object fitted on its own into a cube of targetSize mm:
+// mapped from the cache if this mesh, unit and box were seen before,
+// otherwise read once from the STL and cached. ok is false on failure
+STLMesh LoadFittedMesh(const ObjectConfig& obj, double targetSize, double& fitScale)
+{
+    // Handle units from JSON ("mm", "cm", "m", ...)
+    double unitScale = 1.0;           // CADMesh expects mm by default
+    if (obj.units == "cm") {
+        unitScale = 10.0;             // 1 cm = 10 mm
+    } else if (obj.units == "m") {
+        unitScale = 1000.0;           // 1 m = 1000 mm
+    } else {
+        unitScale = 1.0;              // assume mm
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    STLMesh stl;
+    fitScale = 1.0;
+    uint64_t cacheKey = obj.mesh_cache ? MeshCacheKey(obj.mesh_path, obj.units, targetSize) : 0;
+    std::string cachePath = cacheKey ? MeshCachePath(obj.mesh_path, cacheKey) : "";
+    bool cached = cacheKey && LoadMeshCache(cachePath, cacheKey, stl, fitScale);
+    if (!cached) {
+        stl = LoadSTL(obj.mesh_path);
+        if (!stl.ok) {
+            G4Exception("DetectorConstruction::Construct", "Detector001", FatalException,
+                        ("Cannot read STL mesh " + obj.mesh_path).c_str());
+            return stl;
+        }
+        G4ThreeVector extent = stl.max - stl.min;
+        double maxDim = std::max({extent.x(), extent.y(), extent.z()});
+        if (maxDim > 0.0)
+            fitScale = targetSize / (maxDim * unitScale);
+        stl.Scale(unitScale * fitScale);
+        if (cacheKey && !SaveMeshCache(cachePath, cacheKey, stl, fitScale)) {
+            G4Exception("DetectorConstruction::Construct", "Detector002", JustWarning,
+                        ("Cannot write mesh cache " + cachePath).c_str());
+        }
+    }
+    std::chrono::duration<double> loadTime = std::chrono::steady_clock::now() - start;
+    G4cout << "STL: " << obj.id << ": " << stl.NumTriangles() << " triangles from "
+           << (cached ? cachePath : obj.mesh_path) << " in " << loadTime.count()
+           << " s" << G4endl;
+    return stl;
+}
+
+// Extend the box [lo, hi] to cover [a, b]
+void Grow(G4ThreeVector& lo, G4ThreeVector& hi, const G4ThreeVector& a, const G4ThreeVector& b)
+{
+    lo.set(std::min(lo.x(), a.x()), std::min(lo.y(), a.y()), std::min(lo.z(), a.z()));
+    hi.set(std::max(hi.x(), b.x()), std::max(hi.y(), b.y()), std::max(hi.z(), b.z()));
+}
+
+// Enclosed volume in mm3 (divergence theorem over the closed surface)
+double MeshVolume(const STLMesh& mesh)
+{
+    double sum = 0.0;
+    const float* v = mesh.vertices.data();
+    for (size_t t = 0; t < mesh.NumTriangles(); ++t, v += 9) {
+        G4ThreeVector a(v[0], v[1], v[2]), b(v[3], v[4], v[5]), c(v[6], v[7], v[8]);
+        sum += a.dot(b.cross(c));
+    }
+    return std::abs(sum) / 6.0;
+}
 }
 
 G4VPhysicalVolume* DetectorConstruction::Construct()
 {
     auto& beam = config.beam;
-    auto& obj  = config.object;
 
     // World size: span source to detector (+ some margin) along x
     double srcX = beam.source_pos_mm[0];
@@ -163,67 +228,307 @@ G4VPhysicalVolume* DetectorConstruction::Construct()
     auto* worldPV = new G4PVPlacement(
         nullptr, {}, worldLV, "WorldPV", nullptr, false, 0, true);
 
-    // Material from setup.JSON chemical formula
-    auto* objectMat = [&]() -> G4Material* {
-        double density = obj.material.density_g_cm3 * g/cm3;
+    // Fit the scene into the voxel cube so ParaView shows shape properly
+    const double targetSize = 2.0 * config.voxel_grid.half_size_mm * 0.9; // leave a margin
 
-        // Reuse if already constructed (Geant4 keeps a materials table)
-        if (auto* existing = G4Material::GetMaterial("ModelMat", false)) {
-            return existing;
-        }
+    // Meshes are loaded and fitted; primitives keep their mm size and
+    // position, so their slots in meshes stay empty
+    const size_t nObjects = config.objects.size();
+    std::vector<G4Material*> materials;
+    std::vector<STLMesh> meshes(nObjects);
+    std::vector<double> fitScales(nObjects, 1.0);
+    std::vector<size_t> meshObjects;
+    for (size_t i = 0; i < nObjects; ++i) {
+        const auto& obj = config.objects[i];
+        materials.push_back(BuildMaterial(obj));
+        if (!obj.primitive.type.empty()) continue;
+        meshes[i] = LoadFittedMesh(obj, targetSize, fitScales[i]);
+        if (!meshes[i].ok) return worldPV;
+        meshObjects.push_back(i);
+    }
+    objectMaterials.assign(materials.begin(), materials.end());
 
-        auto atoms = ExpandFormula(obj.material.formula);
+    // Each mesh was fitted (and cached) on its own; one fit for the whole
+    // scene keeps the objects where the CAD export put them
+    G4ThreeVector translation;
+    if (!meshObjects.empty()) {
+        size_t first = meshObjects.front();
+        G4ThreeVector lo = meshes[first].min / fitScales[first], hi = meshes[first].max / fitScales[first];
+        for (size_t i : meshObjects) {
+            G4ThreeVector mlo = meshes[i].min / fitScales[i], mhi = meshes[i].max / fitScales[i];
+            lo.set(std::min(lo.x(), mlo.x()), std::min(lo.y(), mlo.y()), std::min(lo.z(), mlo.z()));
+            hi.set(std::max(hi.x(), mhi.x()), std::max(hi.y(), mhi.y()), std::max(hi.z(), mhi.z()));
+        }
+        G4ThreeVector extent = hi - lo;
+        double maxDim = std::max({extent.x(), extent.y(), extent.z()});
+        double sceneFit = maxDim > 0.0 ? targetSize / maxDim : 1.0;
+        for (size_t i : meshObjects) {
+            double r = sceneFit / fitScales[i];
+            if (std::abs(r - 1.0) > 1e-6) meshes[i].Scale(r);   // a single object is already fitted
+        }
+        G4cout << "Scene: " << meshObjects.size() << " meshes, fit scale " << sceneFit << G4endl;
 
-        auto* m = new G4Material("ModelMat", density, atoms.size());
-        for (const auto& kv : atoms) {
-            auto* el = nist->FindOrBuildElement(kv.first);
-            m->AddElement(el, kv.second);
+        // Bring scene center to origin
+        lo = meshes[first].min;
+        hi = meshes[first].max;
+        for (size_t i : meshObjects) {
+            const auto& m = meshes[i];
+            lo.set(std::min(lo.x(), m.min.x()), std::min(lo.y(), m.min.y()), std::min(lo.z(), m.min.z()));
+            hi.set(std::max(hi.x(), m.max.x()), std::max(hi.y(), m.max.y()), std::max(hi.z(), m.max.z()));
         }
-        return m;
-    }();
+        translation = -(lo + hi) * 0.5 * mm;
+    }
 
-    // Mesh via CADMesh
-    // Use Assimp reader so binary STL (and other formats) are accepted
-    auto mesh = CADMesh::TessellatedMesh::FromSTL(
-        obj.mesh_path,
-        std::make_shared<CADMesh::File::ASSIMPReader>());
+    // Scoring envelope (see ScoringEnvelope). Its region keeps the fine
+    // cuts, the world air gets physics.world_cut_mm, and with kill_outside
+    // the world's EnvelopeLimits stop tracks that cannot reach it. Objects
+    // are placed in it, relative to its centre
+    G4ThreeVector envLo, envHi;
+    ScoringEnvelope(config, envLo, envHi);
+    G4ThreeVector envHalf = (envHi - envLo) * 0.5;
+    G4ThreeVector envCentre = (envHi + envLo) * 0.5 * mm;
 
-    // Handle units from JSON ("mm", "cm", "m", ...)
-    double unitScale = 1.0;           // CADMesh expects mm by default
-    if (obj.units == "cm") {
-        unitScale = 10.0;             // 1 cm = 10 mm
-    } else if (obj.units == "m") {
-        unitScale = 1000.0;           // 1 m = 1000 mm
-    } else {
-        unitScale = 1.0;              // assume mm
+    // World-frame box of every object in every instance, for the
+    // generator's silhouette sampling
+    const double inf = std::numeric_limits<double>::infinity();
+    G4ThreeVector sceneLo(inf, inf, inf), sceneHi(-inf, -inf, -inf);
+    for (size_t i = 0; i < nObjects; ++i) {
+        G4ThreeVector olo, ohi;
+        if (config.objects[i].primitive.type.empty()) {
+            olo = meshes[i].min + translation / mm;
+            ohi = meshes[i].max + translation / mm;
+        } else {
+            PrimitiveBounds(config.objects[i].primitive, olo, ohi);
+        }
+        Grow(sceneLo, sceneHi, olo, ohi);
+    }
+    objectsLo.set(inf, inf, inf);
+    objectsHi.set(-inf, -inf, -inf);
+    size_t copies = config.objects.front().geometry == "voxel" ? 1 : config.instances_mm.size();
+    for (size_t r = 0; r < copies; ++r) {
+        G4ThreeVector offset(config.instances_mm[r][0], config.instances_mm[r][1], config.instances_mm[r][2]);
+        Grow(objectsLo, objectsHi, sceneLo + offset, sceneHi + offset);
     }
+    hasObjectBounds = true;
 
-    // Fit model into the voxel cube so ParaView shows shape properly
-    double fitScale = 1.0;
-    G4ThreeVector translation(0, 0, 0);
-    auto bounds = ComputeSTLBounds(obj.mesh_path);
-    if (bounds.ok) {
-        G4ThreeVector extent = bounds.max - bounds.min;
-        double maxDim = std::max({extent.x(), extent.y(), extent.z()});
-        if (maxDim > 0.0) {
-            double targetSize = 2.0 * config.voxel_grid.half_size_mm * 0.9; // leave a margin
-            double maxDim_mm = maxDim * unitScale;
-            fitScale = targetSize / maxDim_mm;
-            G4ThreeVector center = (bounds.min + bounds.max) * 0.5;
-            G4ThreeVector center_mm = center * unitScale * fitScale;
-            translation = -center_mm * mm; // bring mesh center to origin
+    auto* envelopeSolid = new G4Box("Scoring", envHalf.x() * mm, envHalf.y() * mm, envHalf.z() * mm);
+    auto* envelopeLV = new G4LogicalVolume(envelopeSolid, air, "ScoringLV");
+    new G4PVPlacement(nullptr, envCentre, envelopeLV, "ScoringPV", worldLV, false, 0, true);
+    if (config.physics.kill_outside)
+        worldLV->SetUserLimits(new EnvelopeLimits(envLo * mm, envHi * mm));
+
+    auto* region = new G4Region("ScoringRegion");
+    region->AddRootLogicalVolume(envelopeLV);
+    auto* cuts = new G4ProductionCuts();
+    cuts->SetProductionCut(config.physics.cut_mm * mm);
+    region->SetProductionCuts(cuts);
+    G4cout << "Scoring region: " << 2.0 * envHalf.x() << " x " << 2.0 * envHalf.y() << " x "
+           << 2.0 * envHalf.z() << " mm, cut " << config.physics.cut_mm << " mm (world "
+           << config.physics.world_cut_mm << " mm)" << G4endl;
+
+    if (config.objects.front().geometry == "voxel") {
+        if (config.instances_mm.size() > 1) {
+            G4Exception("DetectorConstruction::Construct", "Detector003", JustWarning,
+                        "The voxel geometry does not support instances; placing one sample.");
         }
+        BuildPhantom(envelopeLV, -envCentre, meshes, translation, air, materials);
+        return worldPV;
     }
 
-    mesh->SetScale(unitScale * fitScale);
+    objectVolumes.clear();
+    for (size_t i = 0; i < nObjects; ++i) {
+        const auto& prim = config.objects[i].primitive;
+        objectVolumes.push_back(prim.type.empty() ? MeshVolume(meshes[i]) : PrimitiveVolume(prim));
+    }
+
+    // Partial-volume fractions of the scoring grid and the voxel mass they
+    // imply; objects are disjoint, so their fractions add up
+    if (config.voxel_grid.occupancy_samples > 0) {
+        auto start = std::chrono::steady_clock::now();
+        VoxelLayout layout = GridLayout();
+        double voxel_cm3 = layout.dx * layout.dy * layout.dz * 1e-3;
+        size_t n = size_t(layout.NX) * layout.NY * layout.NZ;
+        occupancy.assign(n, 0.0f);
+        voxelMass.assign(n, 0.0f);
+        for (size_t i = 0; i < nObjects; ++i) {
+            const auto& prim = config.objects[i].primitive;
+            auto occ = prim.type.empty()
+                ? MeshOccupancy(meshes[i].Corners(1.0), translation, layout,
+                                config.voxel_grid.occupancy_samples)
+                : PrimitiveOccupancy(prim, layout, config.voxel_grid.occupancy_samples);
+            float grams = float(config.objects[i].material.density_g_cm3 * voxel_cm3);
+            for (size_t v = 0; v < n; ++v) {
+                occupancy[v] += occ[v];
+                voxelMass[v] += occ[v] * grams;
+            }
+        }
+        double filled = 0.0;
+        for (auto& f : occupancy) {
+            f = std::min(f, 1.0f);
+            filled += f;
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        G4cout << "Occupancy: " << filled << " of " << n
+               << " voxels filled, computed in " << elapsed.count() << " s" << G4endl;
+    }
 
-    auto* modelSolid = mesh->GetSolid();
-    auto* modelLV    = new G4LogicalVolume(modelSolid, objectMat, "ModelLV");
+    objectLVs.clear();
+    for (size_t i = 0; i < nObjects; ++i) {
+        const auto& obj = config.objects[i];
+        G4VSolid* solid = nullptr;
+        G4RotationMatrix* rotation = nullptr;
+        G4ThreeVector position = translation;
+        if (!obj.primitive.type.empty()) {
+            solid = BuildPrimitiveSolid(obj.id + "Solid", obj.primitive);
+            rotation = PrimitiveRotation(obj.primitive);
+            const auto& c = obj.primitive.position_mm;
+            position = G4ThreeVector(c[0], c[1], c[2]) * mm;
+            G4cout << "Primitive: " << obj.id << ": " << obj.primitive.type << ", "
+                   << objectVolumes[i] << " mm3" << G4endl;
+        } else if (obj.geometry == "bvh") {
+            auto start = std::chrono::steady_clock::now();
+            auto* meshSolid = new MeshSolid(obj.id + "Solid", meshes[i].Corners(1.0));
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            G4cout << "MeshSolid: " << obj.id << ": " << meshSolid->NumTriangles()
+                   << " triangles, " << meshSolid->NumNodes() << " BVH nodes, built in "
+                   << elapsed.count() << " s" << G4endl;
+            solid = meshSolid;
+        } else {
+            auto mesh = CADMesh::TessellatedMesh::FromSTL(
+                obj.mesh_path, std::make_shared<STLMeshReader>(meshes[i]));
+            solid = mesh->GetSolid();
+        }
+        auto* lv = new G4LogicalVolume(solid, materials[i], obj.id + "LV");
+        objectLVs.push_back(lv);
 
-    // Place model at computed position; CADMesh keeps units in mm
-    new G4PVPlacement(
-        nullptr, translation, modelLV,
-        "ModelPV", worldLV, false, 0, true);
+        // Every instance shares the solid and LV; the copy number is the
+        // instance index. CADMesh keeps units in mm
+        for (size_t r = 0; r < config.instances_mm.size(); ++r) {
+            const auto& o = config.instances_mm[r];
+            new G4PVPlacement(
+                rotation, position + G4ThreeVector(o[0], o[1], o[2]) * mm - envCentre, lv,
+                obj.id + "PV", envelopeLV, false, int(r), true);
+        }
+    }
 
     return worldPV;
 }
+
+void DetectorConstruction::ScoringEnvelope(const SceneConfig& cfg, G4ThreeVector& lo,
+                                           G4ThreeVector& hi)
+{
+    // Fitted meshes always lie inside the cube; primitives may stick out
+    const double half = cfg.voxel_grid.half_size_mm;
+    G4ThreeVector sceneLo(-half, -half, -half), sceneHi(half, half, half);
+    for (const auto& obj : cfg.objects) {
+        if (obj.primitive.type.empty()) continue;
+        G4ThreeVector olo, ohi;
+        PrimitiveBounds(obj.primitive, olo, ohi);
+        Grow(sceneLo, sceneHi, olo, ohi);
+    }
+    lo = sceneLo;
+    hi = sceneHi;
+    for (const auto& o : cfg.instances_mm) {
+        G4ThreeVector offset(o[0], o[1], o[2]);
+        Grow(lo, hi, sceneLo + offset, sceneHi + offset);
+    }
+    const G4ThreeVector margin(1.0, 1.0, 1.0);
+    lo -= margin;
+    hi += margin;
+}
+
+VoxelLayout DetectorConstruction::GridLayout() const
+{
+    auto& vg = config.voxel_grid;
+    double half = vg.half_size_mm;
+    return {vg.nx, vg.ny, vg.nz, -half, -half, -half,
+            2.0 * half / vg.nx, 2.0 * half / vg.ny, 2.0 * half / vg.nz};
+}
+
+// Regular-navigation phantom on the voxel_grid layout: the meshes and
+// primitives are only used to label voxels, then transport sees boxes of
+// air or object materials (later objects win where they overlap). Voxel
+// copy numbers follow the VoxelGrid index ix + NX*(iy + NY*iz)
+void DetectorConstruction::BuildPhantom(G4LogicalVolume* motherLV,
+                                        const G4ThreeVector& gridCentre,
+                                        const std::vector<STLMesh>& meshes,
+                                        const G4ThreeVector& translation,
+                                        G4Material* air,
+                                        const std::vector<G4Material*>& objectMats)
+{
+    auto& vg = config.voxel_grid;
+    double half = vg.half_size_mm;
+    VoxelLayout layout = GridLayout();
+    size_t n = size_t(layout.NX) * layout.NY * layout.NZ;
+
+    phantomMaterials.assign(n, 0);
+    for (size_t i = 0; i < meshes.size(); ++i) {
+        const auto& prim = config.objects[i].primitive;
+        if (!prim.type.empty()) {
+            auto inside = PrimitiveOccupancy(prim, layout, 1);
+            for (size_t v = 0; v < n; ++v)
+                if (inside[v] > 0.5f) phantomMaterials[v] = uint16_t(i + 1);
+            continue;
+        }
+        auto inside = VoxelizeMesh(meshes[i].Corners(1.0), translation, layout);
+        for (size_t v = 0; v < n; ++v)
+            if (inside[v]) phantomMaterials[v] = uint16_t(i + 1);
+    }
+
+    // Voxels are all or nothing
+    double voxel_mm3 = layout.dx * layout.dy * layout.dz;
+    occupancy.assign(n, 0.0f);
+    voxelMass.assign(n, 0.0f);
+    objectVolumes.assign(meshes.size(), 0.0);
+    for (size_t v = 0; v < n; ++v) {
+        size_t m = phantomMaterials[v];
+        if (m == 0) continue;
+        occupancy[v] = 1.0f;
+        voxelMass[v] = float(config.objects[m - 1].material.density_g_cm3 * voxel_mm3 * 1e-3);
+        objectVolumes[m - 1] += voxel_mm3;
+    }
+    size_t filled = n - std::count(phantomMaterials.begin(), phantomMaterials.end(), uint16_t(0));
+    G4cout << "Phantom: " << filled << " of " << n
+           << " voxels inside the objects" << G4endl;
+
+    double hx = 0.5 * layout.dx * mm;
+    double hy = 0.5 * layout.dy * mm;
+    double hz = 0.5 * layout.dz * mm;
+
+    auto* containerSolid = new G4Box("Phantom", half * mm, half * mm, half * mm);
+    auto* containerLV = new G4LogicalVolume(containerSolid, air, "PhantomLV");
+    auto* containerPV = new G4PVPlacement(
+        nullptr, gridCentre, containerLV, "PhantomPV", motherLV, false, 0, true);
+
+    std::vector<G4Material*> materials = {air};
+    materials.insert(materials.end(), objectMats.begin(), objectMats.end());
+    auto* param = new CompactPhantomParameterisation(materials, phantomMaterials.data());
+    param->SetVoxelDimensions(hx, hy, hz);
+    param->SetNoVoxels(vg.nx, vg.ny, vg.nz);
+    param->SetMaterials(materials);
+    param->BuildContainerSolid(containerPV);
+    param->CheckVoxelsFillContainer(containerSolid->GetXHalfLength(),
+                                    containerSolid->GetYHalfLength(),
+                                    containerSolid->GetZHalfLength());
+    // Neighbouring voxels of one material are crossed in a single step;
+    // DoseSD spreads such steps over the voxels they cross
+    param->SetSkipEqualMaterials(true);
+
+    // DoseSD attaches to the voxels and skips the air ones by material
+    auto* voxelSolid = new G4Box("Voxel", hx, hy, hz);
+    auto* voxelLV = new G4LogicalVolume(voxelSolid, objectMats.front(), "VoxelLV");
+    auto* phantomPV = new G4PVParameterised(
+        "VoxelPV", voxelLV, containerLV, kUndefined,
+        vg.nx * vg.ny * vg.nz, param);
+    phantomPV->SetRegularStructureId(1);
+    objectLVs = {voxelLV};
+}
+
+// Called on every worker: each thread gets its own DoseSD (and mu_en tables)
+void DetectorConstruction::ConstructSDandField()
+{
+    auto* sd = new DoseSD("ModelSD", config, objectMaterials);
+    G4SDManager::GetSDMpointer()->AddNewDetector(sd);
+    for (auto* lv : objectLVs)
+        SetSensitiveDetector(lv, sd);
+}
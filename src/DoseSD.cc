@@ -0,0 +1,125 @@
+/*
+ * src/DoseSD.cc
+ * Sensitive detector on the object volumes, feeds the worker's voxel grid tiles
+ */
+
+#include "DoseSD.hh"
+#include "DoseVoxelGrid.hh"
+
+#include "G4Gamma.hh"
+#include "G4Material.hh"
+#include "G4Step.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4Track.hh"
+#include "G4VTouchable.hh"
+
+#include <algorithm>
+
+DoseSD::DoseSD(const G4String& name, const SceneConfig& cfg,
+               const std::vector<const G4Material*>& objectMaterials)
+    : G4VSensitiveDetector(name),
+      trackLength_(cfg.voxel_grid.scoring == "track_length"),
+      segment_(cfg.voxel_grid.deposit == "segment"),
+      phantom_(cfg.objects.front().geometry == "voxel"),
+      numObjects_(int(objectMaterials.size())),
+      maxEnergy_(cfg.beam.mono_energy_keV * keV),
+      kerma_(objectMaterials.size())
+{
+    // Kerma tables must reach the hardest spectrum line
+    for (double e : cfg.beam.spectrum_keV)
+        maxEnergy_ = std::max(maxEnergy_, e * keV);
+
+    for (const auto& o : cfg.instances_mm)
+        instanceOffsets_.emplace_back(o[0] * mm, o[1] * mm, o[2] * mm);
+
+    objectOfMaterial_.assign(G4Material::GetNumberOfMaterials(), -1);
+    for (size_t i = 0; i < objectMaterials.size(); ++i)
+        objectOfMaterial_[objectMaterials[i]->GetIndex()] = int(i);
+}
+
+int DoseSD::ObjectOf(const G4Material* material) const
+{
+    size_t i = material->GetIndex();
+    return i < objectOfMaterial_.size() ? objectOfMaterial_[i] : -1;
+}
+
+G4bool DoseSD::ProcessHits(G4Step* step, G4TouchableHistory*)
+{
+    auto pre = step->GetPreStepPoint();
+
+    // Phantom voxels outside the meshes are air; they belong to no object
+    int object = ObjectOf(pre->GetMaterial());
+    if (object < 0)
+        return false;
+
+    // Object placements carry the instance index as copy number; phantom
+    // copy numbers are voxel indices and the phantom is never instanced
+    int replica = phantom_ ? 0 : pre->GetTouchable()->GetCopyNumber();
+
+    if (trackLength_) {
+        ScoreTrackLength(step, object, replica);
+        return true;
+    }
+
+    // Importance-sampled primaries carry a weight, passed on to secondaries
+    auto edep = step->GetTotalEnergyDeposit() * pre->GetWeight();
+    if (edep <= 0.)
+        return false;
+
+    auto& grid = VoxelGrid::Instance();
+    grid.AddObjectEnergy(replica * numObjects_ + object, edep / keV);
+
+    const auto offset = GridOffset(replica);
+    auto pos = pre->GetPosition() - offset;
+
+    // Spread the deposit over the voxels the step chord crosses, so coarse
+    // steps on fine grids do not pile up in the pre-step voxel. Phantom
+    // steps skip the boundaries between voxels of one material, so they
+    // always take this path
+    auto post = step->GetPostStepPoint()->GetPosition() - offset;
+    if ((segment_ || phantom_) && post != pos) {
+        const double a[3] = {pos.x() / mm, pos.y() / mm, pos.z() / mm};
+        const double b[3] = {post.x() / mm, post.y() / mm, post.z() / mm};
+        grid.AddSegment(a, b, (edep / keV) / ((post - pos).mag() / mm), replica);
+        return true;
+    }
+
+    if (phantom_) {
+        // Phantom copy numbers are grid indices already
+        int copy = pre->GetTouchable()->GetReplicaNumber(0);
+        grid.AddEnergyAt(copy % grid.NX, (copy / grid.NX) % grid.NY,
+                         copy / (grid.NX * grid.NY), edep / keV);
+        return true;
+    }
+
+    grid.AddEnergy(pos.x() / mm, pos.y() / mm, pos.z() / mm, edep / keV, replica);
+    return true;
+}
+
+void DoseSD::ScoreTrackLength(const G4Step* step, int object, int replica)
+{
+    // Only photons carry the estimate; their secondaries deposit locally
+    // (kerma approximation), so electron steps are not scored at all
+    if (step->GetTrack()->GetDefinition() != G4Gamma::Definition())
+        return;
+
+    auto pre = step->GetPreStepPoint();
+    auto& kerma = kerma_[object];
+    if (!kerma) {
+        // Physics tables exist by the first step; cover the beam energy
+        kerma = std::make_unique<KermaTable>(pre->GetMaterial(), 1.0 * keV,
+                                             1.05 * maxEnergy_);
+    }
+
+    double energy = pre->GetKineticEnergy();
+    double keVPerMm = (energy / keV) * kerma->MuEn(energy) * mm * pre->GetWeight();
+
+    const auto offset = GridOffset(replica);
+    auto p0 = pre->GetPosition() - offset;
+    auto p1 = step->GetPostStepPoint()->GetPosition() - offset;
+    const double a[3] = {p0.x() / mm, p0.y() / mm, p0.z() / mm};
+    const double b[3] = {p1.x() / mm, p1.y() / mm, p1.z() / mm};
+    auto& grid = VoxelGrid::Instance();
+    grid.AddSegment(a, b, keVPerMm, replica);
+    grid.AddObjectEnergy(replica * numObjects_ + object, keVPerMm * step->GetStepLength() / mm);
+}
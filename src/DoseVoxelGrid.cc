@@ -5,35 +5,440 @@
 
 #include "DoseVoxelGrid.hh"
 
-DoseVoxelGrid& DoseVoxelGrid::Instance() {
-    static DoseVoxelGrid instance;
-    return instance;
+#include "globals.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+#include <type_traits>
+
+namespace {
+std::unique_ptr<VoxelGrid> gInstance;
+
+// dst += src over one tile row; restrict lets the compiler vectorize
+template <typename Acc, typename D, typename S>
+void MergeRow(D* __restrict dst, const S* __restrict src, int n)
+{
+    for (int i = 0; i < n; ++i)
+        Acc::Merge(dst[i], src[i]);
+}
+}
+
+// --- VoxelGrid ---
+
+VoxelGrid& VoxelGrid::Instance() {
+    return *gInstance;
+}
+
+VoxelGrid::Mode VoxelGrid::ParseMode(const std::string& name)
+{
+    if (name == "shared") return Mode::Shared;
+    if (name == "thread_local") return Mode::ThreadLocal;
+    if (name == "atomic") return Mode::Atomic;
+    G4Exception("VoxelGrid::ParseMode", "VoxelGrid001", FatalErrorInArgument,
+                ("Unknown voxel_grid.accumulation: " + name).c_str());
+    return Mode::Shared;
+}
+
+void VoxelGrid::Create(const std::string& precision,
+                       int NX, int NY, int NZ,
+                       float xmin, float ymin, float zmin,
+                       float dx, float dy, float dz,
+                       Mode mode, bool uncertainty, size_t batch, int replicas)
+{
+    if (uncertainty && mode != Mode::ThreadLocal) {
+        G4Exception("VoxelGrid::Create", "VoxelGrid003", JustWarning,
+                    "Uncertainty scoring needs thread_local accumulation; disabled.");
+        uncertainty = false;
+    }
+
+    if (precision == "float") {
+        gInstance = std::make_unique<DoseVoxelGrid<FloatAccumulator>>(
+            NX, NY, NZ, xmin, ymin, zmin, dx, dy, dz, mode, uncertainty, batch, replicas);
+    } else if (precision == "double") {
+        gInstance = std::make_unique<DoseVoxelGrid<DoubleAccumulator>>(
+            NX, NY, NZ, xmin, ymin, zmin, dx, dy, dz, mode, uncertainty, batch, replicas);
+    } else if (precision == "kahan") {
+        gInstance = std::make_unique<DoseVoxelGrid<KahanAccumulator>>(
+            NX, NY, NZ, xmin, ymin, zmin, dx, dy, dz, mode, uncertainty, batch, replicas);
+    } else if (precision == "mixed") {
+        gInstance = std::make_unique<DoseVoxelGrid<MixedAccumulator>>(
+            NX, NY, NZ, xmin, ymin, zmin, dx, dy, dz, mode, uncertainty, batch, replicas);
+    } else {
+        G4Exception("VoxelGrid::Create", "VoxelGrid002", FatalErrorInArgument,
+                    ("Unknown voxel_grid.precision: " + precision).c_str());
+    }
+}
+
+VoxelGrid::VoxelGrid(int NX_, int NY_, int NZ_,
+                     float xmin_, float ymin_, float zmin_,
+                     float dx_, float dy_, float dz_, Mode mode_, bool uncertainty_,
+                     size_t batch_, int replicas_)
+    : NX(NX_), NY(NY_), NZ(NZ_),
+      xmin(xmin_), ymin(ymin_), zmin(zmin_),
+      dx(dx_), dy(dy_), dz(dz_), mode(mode_), uncertainty(uncertainty_),
+      batch(batch_), replicas(std::max(1, replicas_)),
+      planes(NZ_ * replicas),
+      TX((NX_ + kTile - 1) / kTile),
+      TY((NY_ + kTile - 1) / kTile),
+      TZ((planes + kTile - 1) / kTile)
+{}
+
+// --- DoseVoxelGrid<Acc> ---
+
+template <typename Acc>
+thread_local typename DoseVoxelGrid<Acc>::TileSet* DoseVoxelGrid<Acc>::tlsTiles = nullptr;
+
+template <typename Acc>
+DoseVoxelGrid<Acc>::DoseVoxelGrid(int NX_, int NY_, int NZ_,
+                                  float xmin_, float ymin_, float zmin_,
+                                  float dx_, float dy_, float dz_, Mode mode_,
+                                  bool uncertainty_, size_t batch_, int replicas_)
+    : VoxelGrid(NX_, NY_, NZ_, xmin_, ymin_, zmin_, dx_, dy_, dz_, mode_, uncertainty_,
+                batch_, replicas_)
+{
+    size_t n = size_t(NX) * NY * planes;
+    if (mode == Mode::Atomic) {
+        // The master grid is only filled at merge time, keep one copy live
+        for (size_t b = 0; b < n; b += kAtomicBlock)
+            atomicGrid.emplace_back(new std::atomic<shared_type>[std::min(kAtomicBlock, n - b)]());
+    } else {
+        grid.assign(n, shared_type{});
+    }
+    if (uncertainty)
+        grid2.assign(n, shared_type{});
+
+}
+
+template <typename Acc>
+typename DoseVoxelGrid<Acc>::TileSet& DoseVoxelGrid<Acc>::LocalTiles()
+{
+    if (!tlsTiles) {
+        auto local = std::make_unique<TileSet>();
+        if (mode == Mode::ThreadLocal) {
+            local->tiles.resize(size_t(TX) * TY * TZ);
+            if (uncertainty)
+                local->squares.resize(local->tiles.size());
+        }
+        local->pending.reserve(batch);
+        tlsTiles = local.get();
+        G4AutoLock lock(&mutex);
+        workerTiles.push_back(std::move(local));
+    }
+    return *tlsTiles;
+}
+
+template <typename Acc>
+void DoseVoxelGrid<Acc>::AddEnergy(float x_mm, float y_mm, float z_mm, float edep_keV,
+                                   int replica)
+{
+    int ix, iy, iz;
+    if (Locate(x_mm, y_mm, z_mm, ix, iy, iz))
+        Deposit(ix, iy, iz + NZ * replica, edep_keV);
+}
+
+template <typename Acc>
+void DoseVoxelGrid<Acc>::AddEnergyAt(int ix, int iy, int iz, float edep_keV, int replica)
+{
+    Deposit(ix, iy, iz + NZ * replica, edep_keV);
+}
+
+template <typename Acc>
+void DoseVoxelGrid<Acc>::AddSegment(const double p0_mm[3], const double p1_mm[3],
+                                    double keV_per_mm, int replica)
+{
+    Traverse(p0_mm, p1_mm, [&](int ix, int iy, int iz, double len_mm) {
+        Deposit(ix, iy, iz + NZ * replica, static_cast<float>(keV_per_mm * len_mm));
+    });
+}
+
+template <typename Acc>
+void DoseVoxelGrid<Acc>::AddObjectEnergy(int object, double edep_keV)
+{
+    auto& objects = LocalTiles().objects;
+    if (size_t(object) >= objects.size())
+        objects.resize(object + 1, 0.0);
+    objects[object] += edep_keV;
+}
+
+template <typename Acc>
+void DoseVoxelGrid<Acc>::Deposit(int ix, int iy, int iz, float edep_keV)
+{
+    uint64_t key;
+    if (mode == Mode::ThreadLocal) {
+        size_t t = (ix >> kTileBits) +
+                   size_t(TX) * ((iy >> kTileBits) + size_t(TY) * (iz >> kTileBits));
+        const int m = kTile - 1;
+        int c = (ix & m) + kTile * ((iy & m) + kTile * (iz & m));
+        key = uint64_t(t) * kTileVoxels + c;
+    } else {
+        key = ix + uint64_t(NX) * (iy + uint64_t(NY) * iz);
+    }
+
+    // Squares need the whole history's deposit, so hold it until EndHistory;
+    // plain batching applies the buffer voxel-sorted once it fills up
+    if (uncertainty || batch > 0) {
+        // Consecutive steps mostly stay in one voxel: extend the last entry
+        auto& local = LocalTiles();
+        if (!local.pending.empty() && local.pending.back().key == key) {
+            local.pending.back().edep += edep_keV;
+            return;
+        }
+        local.pending.push_back({key, edep_keV});
+        if (!uncertainty && local.pending.size() >= batch)
+            FlushPending(local, false);
+        return;
+    }
+
+    if (mode == Mode::ThreadLocal) {
+        AddToTile(LocalTiles(), key, edep_keV);
+        return;
+    }
+    if (mode == Mode::Shared) {
+        G4AutoLock lock(&mutex);
+        AddToGrid(key, edep_keV);
+        return;
+    }
+    AddToGrid(key, edep_keV);
+}
+
+template <typename Acc>
+void DoseVoxelGrid<Acc>::AddToTile(TileSet& local, uint64_t key, float edep_keV)
+{
+    size_t t = key / kTileVoxels;
+    auto& tile = GetTile(local, local.tiles, t);
+    Acc::Add(tile.cells[key % kTileVoxels], edep_keV);
+    if constexpr (Acc::kFlushDeposits > 0) {
+        if (++tile.deposits >= Acc::kFlushDeposits)
+            FlushTile(local, t);
+    }
+}
+
+// Shared mode expects the caller to hold the mutex
+template <typename Acc>
+void DoseVoxelGrid<Acc>::AddToGrid(uint64_t key, float edep_keV)
+{
+    if (mode == Mode::Atomic) {
+        // No float fetch_add in C++17: retry until no other thread raced us
+        auto& cell = atomicGrid[key >> kAtomicBlockBits][key & (kAtomicBlock - 1)];
+        shared_type old = cell.load(std::memory_order_relaxed);
+        shared_type sum;
+        do {
+            sum = old;
+            Acc::Add(sum, edep_keV);
+        } while (!cell.compare_exchange_weak(old, sum, std::memory_order_relaxed));
+        return;
+    }
+
+    Acc::Add(grid[key], edep_keV);
+}
+
+// Sort the buffer by voxel, sum repeated voxels and apply each once, so the
+// grid is walked in memory order; squares adds the per-history x^2 as well
+template <typename Acc>
+void DoseVoxelGrid<Acc>::FlushPending(TileSet& local, bool squares)
+{
+    auto& pending = local.pending;
+    if (pending.empty()) return;
+
+    std::sort(pending.begin(), pending.end(),
+              [](const Pending& a, const Pending& b) { return a.key < b.key; });
+
+    // Shared mode takes the lock once per buffer instead of per deposit
+    std::unique_ptr<G4AutoLock> lock;
+    if (mode == Mode::Shared)
+        lock = std::make_unique<G4AutoLock>(&mutex);
+
+    for (size_t i = 0; i < pending.size();) {
+        uint64_t key = pending[i].key;
+        float e = 0.0f;
+        for (; i < pending.size() && pending[i].key == key; ++i)
+            e += pending[i].edep;
+
+        if (squares) {
+            size_t t = key / kTileVoxels;
+            Acc::Add(GetTile(local, local.squares, t).cells[key % kTileVoxels], e * e);
+        }
+        if (mode == Mode::ThreadLocal)
+            AddToTile(local, key, e);
+        else
+            AddToGrid(key, e);
+    }
+    pending.clear();
 }
 
-void DoseVoxelGrid::Initialize(int NX_, int NY_, int NZ_,
-                               float xmin_, float ymin_, float zmin_,
-                               float dx_, float dy_, float dz_) 
+template <typename Acc>
+typename DoseVoxelGrid<Acc>::Tile&
+DoseVoxelGrid<Acc>::GetTile(TileSet& local, std::vector<std::unique_ptr<Tile>>& tiles, size_t t)
+{
+    auto& tile = tiles[t];
+    if (!tile) {
+        tile = std::make_unique<Tile>();
+        ++local.allocated;
+    }
+    return *tile;
+}
+
+template <typename Acc>
+void DoseVoxelGrid<Acc>::EndHistory()
+{
+    if (!uncertainty && batch == 0) return;
+    auto& local = LocalTiles();
+    if (uncertainty) ++local.histories;
+    FlushPending(local, uncertainty);
+}
+
+// Move one worker tile (and its squares) into the master grids mid-run
+template <typename Acc>
+void DoseVoxelGrid<Acc>::FlushTile(TileSet& local, size_t t)
 {
     G4AutoLock lock(&mutex);
-    NX = NX_; NY = NY_; NZ = NZ_;
-    xmin = xmin_; ymin = ymin_; zmin = zmin_;
-    dx = dx_; dy = dy_; dz = dz_;
+    MergeTile(t, *local.tiles[t], grid);
+    if (uncertainty && local.squares[t])
+        MergeTile(t, *local.squares[t], grid2);
+}
+
+// Add one worker tile into the master grid and clear it; caller makes sure
+// no other thread writes the same master tile
+template <typename Acc>
+void DoseVoxelGrid<Acc>::MergeTile(size_t t, Tile& tile, std::vector<shared_type>& dst)
+{
+    int x0 = int(t % TX) * kTile;
+    int y0 = int((t / TX) % TY) * kTile;
+    int z0 = int(t / (size_t(TX) * TY)) * kTile;
+    int nx = std::min(kTile, NX - x0);
+    int ny = std::min(kTile, NY - y0);
+    int nz = std::min(kTile, planes - z0);
+
+    for (int lz = 0; lz < nz; ++lz)
+        for (int ly = 0; ly < ny; ++ly) {
+            size_t row = x0 + size_t(NX) * ((y0 + ly) + size_t(NY) * (z0 + lz));
+            MergeRow<Acc>(dst.data() + row, tile.cells + kTile * (ly + kTile * lz), nx);
+        }
 
-    grid.assign(NX * NY * NZ, 0.0f);
+    std::fill(std::begin(tile.cells), std::end(tile.cells), worker_type{});
+    tile.deposits = 0;
 }
 
-void DoseVoxelGrid::AddEnergy(float x_mm, float y_mm, float z_mm, float edep_keV)
+template <typename Acc>
+void DoseVoxelGrid<Acc>::Merge(bool final)
 {
     G4AutoLock lock(&mutex);
-    int ix = int((x_mm - xmin) / dx);
-    int iy = int((y_mm - ymin) / dy);
-    int iz = int((z_mm - zmin) / dz);
+    for (auto& w : workerTiles) {
+        if (objectEnergy.size() < w->objects.size())
+            objectEnergy.resize(w->objects.size(), 0.0);
+        for (size_t i = 0; i < w->objects.size(); ++i)
+            objectEnergy[i] += w->objects[i];
+        std::fill(w->objects.begin(), w->objects.end(), 0.0);
+    }
 
-    if (ix < 0 || ix >= NX ||
-        iy < 0 || iy >= NY ||
-        iz < 0 || iz >= NZ)
+    if (!atomicGrid.empty()) {
+        size_t n = size_t(NX) * NY * planes;
+        if (!final) {
+            grid.resize(n);
+            for (size_t i = 0; i < n; ++i)
+                grid[i] = atomicGrid[i >> kAtomicBlockBits][i & (kAtomicBlock - 1)]
+                              .load(std::memory_order_relaxed);
+            return;
+        }
+        // Append block by block and free each one behind: reserve does not
+        // touch the pages, so the peak stays near one grid plus one block
+        grid.clear();
+        grid.reserve(n);
+        for (size_t b = 0; b < atomicGrid.size(); ++b) {
+            size_t count = std::min(kAtomicBlock, n - b * kAtomicBlock);
+            for (size_t i = 0; i < count; ++i)
+                grid.push_back(atomicGrid[b][i].load(std::memory_order_relaxed));
+            atomicGrid[b].reset();
+        }
+        atomicGrid.clear();
         return;
+    }
+    if (workerTiles.empty()) return;
+
+    size_t nTiles = size_t(TX) * TY * TZ;
+    size_t allocated = 0;
+    for (auto& w : workerTiles) {
+        allocated += w->allocated;
+        histories += w->histories;
+        w->histories = 0;
+    }
+    if (allocated == 0) return;
 
-    int idx = ix + NX * (iy + NY * iz);
-    grid[idx] += edep_keV;
+    // Tiles are disjoint in the master grid, so threads pull blocks of tile
+    // ids and sum every worker's copy; unallocated tiles cost one null check
+    const size_t block = 64;
+    std::atomic<size_t> next{0};
+    auto mergeBlocks = [&]() {
+        for (size_t b = next.fetch_add(block); b < nTiles; b = next.fetch_add(block))
+            for (size_t t = b; t < std::min(nTiles, b + block); ++t)
+                for (auto& w : workerTiles) {
+                    if (auto& tile = w->tiles[t]) {
+                        MergeTile(t, *tile, grid);
+                        tile.reset();
+                    }
+                    if (!uncertainty) continue;
+                    if (auto& square = w->squares[t]) {
+                        MergeTile(t, *square, grid2);
+                        square.reset();
+                    }
+                }
+    };
+
+    size_t nThreads = std::max(1u, std::thread::hardware_concurrency());
+    nThreads = std::min(nThreads, std::max<size_t>(1, allocated / 16));
+
+    std::vector<std::thread> pool;
+    for (size_t i = 1; i < nThreads; ++i)
+        pool.emplace_back(mergeBlocks);
+    mergeBlocks();
+    for (auto& t : pool) t.join();
+
+    for (auto& w : workerTiles) w->allocated = 0;
+
+    G4cout << "DoseVoxelGrid: merged " << allocated << " worker tiles ("
+           << allocated * sizeof(Tile) / (1024.0 * 1024.0)
+           << " MB) from " << workerTiles.size() << " threads" << G4endl;
 }
+
+template <typename Acc>
+std::vector<float> DoseVoxelGrid<Acc>::Energy() const
+{
+    std::vector<float> out(grid.size());
+    for (size_t i = 0; i < grid.size(); ++i)
+        out[i] = static_cast<float>(Acc::Value(grid[i]));
+    return out;
+}
+
+template <typename Acc>
+const float* DoseVoxelGrid<Acc>::EnergyData() const
+{
+    if constexpr (std::is_same_v<shared_type, float>)
+        return grid.data();
+    return nullptr;
+}
+
+template <typename Acc>
+std::vector<float> DoseVoxelGrid<Acc>::Uncertainty() const
+{
+    if (!uncertainty) return {};
+
+    // History-by-history estimate: with N histories and per-voxel sums
+    // S = sum x_i, Q = sum x_i^2, var(mean) = (Q/N - (S/N)^2) / (N - 1)
+    const double N = double(histories);
+    std::vector<float> out(grid.size(), 1.0f);
+    if (N < 2) return out;
+    for (size_t i = 0; i < grid.size(); ++i) {
+        double mean = Acc::Value(grid[i]) / N;
+        if (mean <= 0.0) continue;
+        double var = (Acc::Value(grid2[i]) / N - mean * mean) / (N - 1.0);
+        out[i] = static_cast<float>(std::sqrt(std::max(var, 0.0)) / mean);
+    }
+    return out;
+}
+
+template class DoseVoxelGrid<FloatAccumulator>;
+template class DoseVoxelGrid<DoubleAccumulator>;
+template class DoseVoxelGrid<KahanAccumulator>;
+template class DoseVoxelGrid<MixedAccumulator>;
@@ -0,0 +1,34 @@
+/*
+ * src/EnvelopeLimits.cc
+ * Stops world tracks that cannot reach the scoring envelope
+ */
+
+#include "EnvelopeLimits.hh"
+
+#include "G4Track.hh"
+
+#include <algorithm>
+#include <cfloat>
+
+EnvelopeLimits::EnvelopeLimits(const G4ThreeVector& lo_, const G4ThreeVector& hi_)
+    : G4UserLimits("EnvelopeLimits"), lo(lo_), hi(hi_)
+{}
+
+G4double EnvelopeLimits::GetUserMinEkine(const G4Track& track)
+{
+    // Slab test over t > 0; a track just leaving the box has t1 ~ 0
+    const G4ThreeVector& p = track.GetPosition();
+    const G4ThreeVector& d = track.GetMomentumDirection();
+    double t0 = 0.0, t1 = DBL_MAX;
+    for (int a = 0; a < 3; ++a) {
+        if (d[a] == 0.0) {
+            if (p[a] < lo[a] || p[a] > hi[a]) return DBL_MAX;
+            continue;
+        }
+        double ta = (lo[a] - p[a]) / d[a];
+        double tb = (hi[a] - p[a]) / d[a];
+        t0 = std::max(t0, std::min(ta, tb));
+        t1 = std::min(t1, std::max(ta, tb));
+    }
+    return (t0 > t1 || t1 <= 0.0) ? DBL_MAX : 0.0;
+}
@@ -0,0 +1,14 @@
+/*
+ * src/EventAction.cc
+ * Closes each history in the voxel grid (per-history uncertainty scoring)
+ */
+
+#include "EventAction.hh"
+#include "DoseVoxelGrid.hh"
+
+#include "G4Event.hh"
+
+void EventAction::EndOfEventAction(const G4Event*)
+{
+    VoxelGrid::Instance().EndHistory();
+}
@@ -8,7 +8,7 @@
 #include <iostream>
 
 void VTIWriter::Write(const std::string& filename,
-                      const std::vector<float>& data,
+                      const std::vector<VTIField>& fields,
                       int NX, int NY, int NZ,
                       float xmin, float ymin, float zmin,
                       float dx, float dy, float dz,
@@ -45,19 +45,39 @@ void VTIWriter::Write(const std::string& filename,
       << "Origin=\"" << xmin << " " << ymin << " " << zmin << "\" "
       << "Spacing=\"" << dx << " " << dy << " " << dz << "\">\n";
 
+    // Run metadata as string field data (same layout as the Python writers)
+    if (!metadata.empty()) {
+        f << "    <FieldData>\n";
+        for (const auto& [key, value] : metadata) {
+            f << "      <DataArray type=\"String\" Name=\"" << key
+              << "\" format=\"ascii\" NumberOfComponents=\"1\">\n";
+            f << "        " << value << "\n";
+            f << "      </DataArray>\n";
+        }
+        f << "    </FieldData>\n";
+    }
+
     f << "    <Piece Extent=\""
       << x0 << " " << x1 << " "
       << y0 << " " << y1 << " "
       << z0 << " " << z1 << "\">\n";
 
     f << "      <PointData/>\n";
-    f << "      <CellData Scalars=\"edep_keV\">\n";
-    f << "        <DataArray type=\"Float32\" Name=\"edep_keV\" format=\"ascii\">\n";
+    f << "      <CellData Scalars=\"" << (fields.empty() ? "" : fields[0].name) << "\">\n";
 
-    for (size_t i = 0; i < data.size(); ++i)
-        f << data[i] << " ";
+    for (const auto& field : fields) {
+        f << "        <DataArray type=\"Float32\" Name=\"" << field.name << "\" format=\"ascii\">\n";
 
-    f << "\n        </DataArray>\n";
+        if (field.scale == 1.0f) {
+            for (size_t i = 0; i < field.size; ++i)
+                f << field.data[i] << " ";
+        } else {
+            for (size_t i = 0; i < field.size; ++i)
+                f << field.data[i] * field.scale << " ";
+        }
+
+        f << "\n        </DataArray>\n";
+    }
     f << "      </CellData>\n";
     f << "    </Piece>\n";
 
@@ -0,0 +1,125 @@
+/*
+ * src/MeshCache.cc
+ * Binary cache of fitted STL meshes
+ */
+
+#include "MeshCache.hh"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include <unistd.h>
+
+namespace {
+constexpr char kMagic[8] = {'M', 'V', 'E', 'M', 'E', 'S', 'H', '1'};
+
+// Followed by 9 vertex floats per triangle, then 3 normal floats
+struct Header {
+    char magic[8];
+    uint64_t key;
+    uint64_t triangles;
+    double fitScale;
+    double min[3], max[3];
+};
+
+uint64_t Mix(uint64_t h, uint64_t v)
+{
+    h = (h ^ v) * 0x9E3779B97F4A7C15ULL;
+    return h ^ (h >> 29);
+}
+
+uint64_t HashBytes(uint64_t h, const char* data, size_t size)
+{
+    size_t words = size / 8;
+    for (size_t i = 0; i < words; ++i) {
+        uint64_t v;
+        std::memcpy(&v, data + 8 * i, 8);
+        h = Mix(h, v);
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, data + 8 * words, size - 8 * words);
+    return Mix(Mix(h, tail), size);
+}
+}
+
+uint64_t MeshCacheKey(const std::string& meshPath, const std::string& units,
+                      double targetSize_mm)
+{
+    MappedFile file(meshPath);
+    if (!file.data) return 0;
+    uint64_t h = HashBytes(0xCBF29CE484222325ULL, file.data, file.size);
+    h = HashBytes(h, units.data(), units.size());
+    uint64_t target;
+    std::memcpy(&target, &targetSize_mm, sizeof(target));
+    h = Mix(h, target);
+    return h ? h : 1;
+}
+
+std::string MeshCachePath(const std::string& meshPath, uint64_t key)
+{
+    char hex[17];
+    std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(key));
+    return meshPath + "." + hex + ".meshcache";
+}
+
+bool LoadMeshCache(const std::string& cachePath, uint64_t key,
+                   STLMesh& mesh, double& fitScale)
+{
+    MappedFile file(cachePath);
+    if (!file.data || file.size < sizeof(Header)) return false;
+
+    Header h;
+    std::memcpy(&h, file.data, sizeof(h));
+    if (std::memcmp(h.magic, kMagic, sizeof(kMagic)) != 0 || h.key != key) return false;
+    if (h.triangles == 0 || file.size != sizeof(Header) + h.triangles * 12 * sizeof(float))
+        return false;
+
+    const char* p = file.data + sizeof(Header);
+    mesh.vertices.resize(h.triangles * 9);
+    mesh.normals.resize(h.triangles * 3);
+    std::memcpy(mesh.vertices.data(), p, mesh.vertices.size() * sizeof(float));
+    p += mesh.vertices.size() * sizeof(float);
+    std::memcpy(mesh.normals.data(), p, mesh.normals.size() * sizeof(float));
+    mesh.min = G4ThreeVector(h.min[0], h.min[1], h.min[2]);
+    mesh.max = G4ThreeVector(h.max[0], h.max[1], h.max[2]);
+    mesh.ok = true;
+    fitScale = h.fitScale;
+    return true;
+}
+
+bool SaveMeshCache(const std::string& cachePath, uint64_t key,
+                   const STLMesh& mesh, double fitScale)
+{
+    Header h{};
+    std::memcpy(h.magic, kMagic, sizeof(kMagic));
+    h.key = key;
+    h.triangles = mesh.NumTriangles();
+    h.fitScale = fitScale;
+    for (int a = 0; a < 3; ++a) {
+        h.min[a] = mesh.min[a];
+        h.max[a] = mesh.max[a];
+    }
+
+    // Write under a temporary name so a concurrent run never maps half a file
+    std::string tmp = cachePath + ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream out(tmp, std::ios::binary);
+        if (!out) return false;
+        out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        out.write(reinterpret_cast<const char*>(mesh.vertices.data()),
+                  std::streamsize(mesh.vertices.size() * sizeof(float)));
+        out.write(reinterpret_cast<const char*>(mesh.normals.data()),
+                  std::streamsize(mesh.normals.size() * sizeof(float)));
+        if (!out) {
+            out.close();
+            std::remove(tmp.c_str());
+            return false;
+        }
+    }
+    if (std::rename(tmp.c_str(), cachePath.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
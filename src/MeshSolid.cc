@@ -0,0 +1,472 @@
+/*
+ * src/MeshSolid.cc
+ * BVH-accelerated triangle mesh solid
+ */
+
+#include "MeshSolid.hh"
+
+#include "G4AffineTransform.hh"
+#include "G4BoundingEnvelope.hh"
+#include "G4GeometryTolerance.hh"
+#include "G4PolyhedronArbitrary.hh"
+#include "G4VGraphicsScene.hh"
+#include "G4VoxelLimits.hh"
+#include "Randomize.hh"
+#include "geomdefs.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <sstream>
+
+namespace {
+// BVH traversal only; the G4VSolid interface returns kInfinity instead
+constexpr double kInf = std::numeric_limits<double>::infinity();
+
+// DistanceToOut calls that found no exit facet, over all mesh solids
+std::atomic<long long> gMissedExits{0};
+
+// Isotropic safeties may underestimate the true distance by this factor;
+// an exact nearest-triangle search from deep inside visits most leaves
+constexpr double kSafetyScale = 0.75;
+
+float RoundDown(double x) { return std::nextafter(float(x), -std::numeric_limits<float>::infinity()); }
+float RoundUp(double x) { return std::nextafter(float(x), std::numeric_limits<float>::infinity()); }
+
+// Closest point to p on triangle abc (Ericson, Real-Time Collision Detection 5.1.5)
+G4ThreeVector ClosestOnTriangle(const G4ThreeVector& p, const G4ThreeVector& a,
+                                const G4ThreeVector& b, const G4ThreeVector& c)
+{
+    G4ThreeVector ab = b - a, ac = c - a, ap = p - a;
+    double d1 = ab.dot(ap), d2 = ac.dot(ap);
+    if (d1 <= 0.0 && d2 <= 0.0) return a;
+
+    G4ThreeVector bp = p - b;
+    double d3 = ab.dot(bp), d4 = ac.dot(bp);
+    if (d3 >= 0.0 && d4 <= d3) return b;
+
+    double vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0) return a + ab * (d1 / (d1 - d3));
+
+    G4ThreeVector cp = p - c;
+    double d5 = ab.dot(cp), d6 = ac.dot(cp);
+    if (d6 >= 0.0 && d5 <= d6) return c;
+
+    double vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0) return a + ac * (d2 / (d2 - d6));
+
+    double va = d3 * d6 - d5 * d4;
+    if (va <= 0.0 && (d4 - d3) >= 0.0 && (d5 - d6) >= 0.0)
+        return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+    double denom = 1.0 / (va + vb + vc);
+    return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+// Slab test against a node box; entry distance or +inf on a miss
+double SlabEntry(const float bmin[3], const float bmax[3],
+                  const double o[3], const double inv[3],
+                  double tMin, double tMax)
+{
+    for (int a = 0; a < 3; ++a) {
+        double ta = (bmin[a] - o[a]) * inv[a];
+        double tb = (bmax[a] - o[a]) * inv[a];
+        if (ta > tb) std::swap(ta, tb);
+        // A NaN (origin on the slab plane of a parallel ray) keeps the range
+        tMin = ta > tMin ? ta : tMin;
+        tMax = tb < tMax ? tb : tMax;
+    }
+    return tMin <= tMax ? tMin : kInf;
+}
+}
+
+MeshSolid::MeshSolid(const G4String& name, const std::vector<G4ThreeVector>& triangles)
+    : G4VSolid(name)
+{
+    // Drop degenerate triangles; they have no normal and never get hit
+    for (size_t i = 0; i + 2 < triangles.size(); i += 3) {
+        const auto &a = triangles[i], &b = triangles[i + 1], &c = triangles[i + 2];
+        G4ThreeVector n = (b - a).cross(c - a);
+        if (n.mag2() == 0.0) continue;
+        vertices.push_back(a);
+        vertices.push_back(b);
+        vertices.push_back(c);
+        normals.push_back(n.unit());
+    }
+
+    const int nTri = int(normals.size());
+    if (nTri == 0) {
+        G4Exception("MeshSolid::MeshSolid", "MeshSolid001", FatalException,
+                    ("Mesh " + name + " has no valid triangles.").c_str());
+        return;
+    }
+
+    std::vector<G4ThreeVector> centroids(nTri);
+    std::vector<int> order(nTri);
+    double area = 0.0;
+    cumulativeArea.resize(nTri);
+    bmin = bmax = vertices[0];
+    for (int t = 0; t < nTri; ++t) {
+        const auto &a = vertices[3 * t], &b = vertices[3 * t + 1], &c = vertices[3 * t + 2];
+        centroids[t] = (a + b + c) / 3.0;
+        order[t] = t;
+        area += 0.5 * (b - a).cross(c - a).mag();
+        cumulativeArea[t] = area;
+        for (const auto* v : {&a, &b, &c}) {
+            bmin.set(std::min(bmin.x(), v->x()), std::min(bmin.y(), v->y()), std::min(bmin.z(), v->z()));
+            bmax.set(std::max(bmax.x(), v->x()), std::max(bmax.y(), v->y()), std::max(bmax.z(), v->z()));
+        }
+    }
+
+    nodes.reserve(size_t(nTri));
+    packets.reserve(size_t(nTri) / 2 + 1);
+    nodes.resize(1);
+    Build(0, order, 0, nTri, centroids);
+}
+
+// Median split on the longest centroid axis; children are stored next to
+// each other so an inner node only needs the index of the left one
+void MeshSolid::Build(int index, std::vector<int>& order, int begin, int end,
+                      const std::vector<G4ThreeVector>& centroids)
+{
+    G4ThreeVector lo(kInf, kInf, kInf), hi(-kInf, -kInf, -kInf);
+    G4ThreeVector clo = lo, chi = hi;
+    for (int i = begin; i < end; ++i) {
+        int t = order[i];
+        for (int k = 0; k < 3; ++k) {
+            const auto& v = vertices[3 * t + k];
+            lo.set(std::min(lo.x(), v.x()), std::min(lo.y(), v.y()), std::min(lo.z(), v.z()));
+            hi.set(std::max(hi.x(), v.x()), std::max(hi.y(), v.y()), std::max(hi.z(), v.z()));
+        }
+        const auto& c = centroids[t];
+        clo.set(std::min(clo.x(), c.x()), std::min(clo.y(), c.y()), std::min(clo.z(), c.z()));
+        chi.set(std::max(chi.x(), c.x()), std::max(chi.y(), c.y()), std::max(chi.z(), c.z()));
+    }
+    for (int a = 0; a < 3; ++a) {
+        nodes[index].bmin[a] = RoundDown(lo[a]);
+        nodes[index].bmax[a] = RoundUp(hi[a]);
+    }
+
+    if (end - begin <= kLanes) {
+        Packet pk{};
+        for (int k = 0; k < kLanes; ++k) {
+            pk.tri[k] = -1;
+            if (begin + k >= end) continue;   // padding: zero edges never hit
+            int t = order[begin + k];
+            const auto &a = vertices[3 * t], &b = vertices[3 * t + 1], &c = vertices[3 * t + 2];
+            pk.tri[k] = t;
+            pk.ax[k] = a.x();  pk.ay[k] = a.y();  pk.az[k] = a.z();
+            pk.e1x[k] = b.x() - a.x();  pk.e1y[k] = b.y() - a.y();  pk.e1z[k] = b.z() - a.z();
+            pk.e2x[k] = c.x() - a.x();  pk.e2y[k] = c.y() - a.y();  pk.e2z[k] = c.z() - a.z();
+        }
+        nodes[index].first = int32_t(packets.size());
+        nodes[index].count = end - begin;
+        packets.push_back(pk);
+        return;
+    }
+
+    G4ThreeVector ext = chi - clo;
+    int axis = (ext.x() > ext.y()) ? (ext.x() > ext.z() ? 0 : 2) : (ext.y() > ext.z() ? 1 : 2);
+    int mid = begin + (end - begin) / 2;
+    std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+                     [&](int a, int b) { return centroids[a][axis] < centroids[b][axis]; });
+
+    int left = int(nodes.size());
+    nodes[index].first = left;
+    nodes[index].count = 0;
+    nodes.resize(nodes.size() + 2);
+    Build(left, order, begin, mid, centroids);
+    Build(left + 1, order, mid, end, centroids);
+}
+
+template <typename OnHit>
+void MeshSolid::Intersect(const G4ThreeVector& p, const G4ThreeVector& v,
+                          double tMin, double& tMax, OnHit&& onHit) const
+{
+    const double o[3] = {p.x(), p.y(), p.z()};
+    const double d[3] = {v.x(), v.y(), v.z()};
+    const double inv[3] = {1.0 / d[0], 1.0 / d[1], 1.0 / d[2]};
+
+    int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const Node& node = nodes[stack[--top]];
+        if (SlabEntry(node.bmin, node.bmax, o, inv, tMin, tMax) == kInf) continue;
+
+        if (node.count == 0) {
+            // Visit the nearer child first so nearest-hit queries prune early
+            int l = node.first, r = node.first + 1;
+            double tl = SlabEntry(nodes[l].bmin, nodes[l].bmax, o, inv, tMin, tMax);
+            double tr = SlabEntry(nodes[r].bmin, nodes[r].bmax, o, inv, tMin, tMax);
+            if (tl > tr) { std::swap(l, r); std::swap(tl, tr); }
+            if (tr != kInf) stack[top++] = r;
+            if (tl != kInf) stack[top++] = l;
+            continue;
+        }
+
+        // Moller-Trumbore on all lanes at once; branch-free so it vectorizes
+        const Packet& pk = packets[node.first];
+        double t[kLanes], u[kLanes], w[kLanes], det[kLanes];
+        for (int k = 0; k < kLanes; ++k) {
+            double px = d[1] * pk.e2z[k] - d[2] * pk.e2y[k];
+            double py = d[2] * pk.e2x[k] - d[0] * pk.e2z[k];
+            double pz = d[0] * pk.e2y[k] - d[1] * pk.e2x[k];
+            det[k] = pk.e1x[k] * px + pk.e1y[k] * py + pk.e1z[k] * pz;
+            double invDet = 1.0 / det[k];
+            double sx = o[0] - pk.ax[k], sy = o[1] - pk.ay[k], sz = o[2] - pk.az[k];
+            u[k] = (sx * px + sy * py + sz * pz) * invDet;
+            double qx = sy * pk.e1z[k] - sz * pk.e1y[k];
+            double qy = sz * pk.e1x[k] - sx * pk.e1z[k];
+            double qz = sx * pk.e1y[k] - sy * pk.e1x[k];
+            w[k] = (d[0] * qx + d[1] * qy + d[2] * qz) * invDet;
+            t[k] = (pk.e2x[k] * qx + pk.e2y[k] * qy + pk.e2z[k] * qz) * invDet;
+        }
+        for (int k = 0; k < node.count; ++k) {
+            if (det[k] == 0.0 || !(u[k] >= 0.0) || !(w[k] >= 0.0) || u[k] + w[k] > 1.0)
+                continue;
+            if (t[k] < tMin || t[k] > tMax) continue;
+            onHit(pk.tri[k], t[k], u[k], w[k], tMax);
+        }
+    }
+}
+
+double MeshSolid::NearestHit(const G4ThreeVector& p, const G4ThreeVector& v,
+                             int sign, int* tri) const
+{
+    const double halfTol = 0.5 * kCarTolerance;
+    double tMax = kInf;
+    int best = -1;
+    Intersect(p, v, -halfTol, tMax, [&](int t, double dist, double, double, double& limit) {
+        if (normals[t].dot(v) * sign <= 0.0) return;
+        best = t;
+        limit = dist;
+    });
+    if (tri) *tri = best;
+    if (best < 0) return kInf;
+    return tMax <= halfTol ? 0.0 : tMax;   // on the surface already
+}
+
+double MeshSolid::BoxDistance(const G4ThreeVector& p) const
+{
+    double dx = std::max({bmin.x() - p.x(), 0.0, p.x() - bmax.x()});
+    double dy = std::max({bmin.y() - p.y(), 0.0, p.y() - bmax.y()});
+    double dz = std::max({bmin.z() - p.z(), 0.0, p.z() - bmax.z()});
+    return std::sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+double MeshSolid::Safety(const G4ThreeVector& p, double scale, double maxDist, int* tri) const
+{
+    auto boxDist2 = [&](const Node& n) {
+        double d2 = 0.0;
+        for (int a = 0; a < 3; ++a) {
+            double e = std::max({n.bmin[a] - p[a], 0.0, p[a] - n.bmax[a]});
+            d2 += e * e;
+        }
+        return d2;
+    };
+
+    // Nodes farther than scale * best are skipped, so the result is a lower
+    // bound within that factor; scale 1 gives the exact distance
+    const double scale2 = scale * scale;
+    double best2 = maxDist * maxDist;
+    int bestTri = -1;
+    int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const Node& node = nodes[stack[--top]];
+        if (boxDist2(node) >= best2 * scale2) continue;
+
+        if (node.count == 0) {
+            int l = node.first, r = node.first + 1;
+            double dl = boxDist2(nodes[l]), dr = boxDist2(nodes[r]);
+            if (dl > dr) { std::swap(l, r); std::swap(dl, dr); }
+            if (dr < best2 * scale2) stack[top++] = r;
+            if (dl < best2 * scale2) stack[top++] = l;
+            continue;
+        }
+
+        const Packet& pk = packets[node.first];
+        for (int k = 0; k < node.count; ++k) {
+            int t = pk.tri[k];
+            G4ThreeVector q = ClosestOnTriangle(p, vertices[3 * t], vertices[3 * t + 1],
+                                                vertices[3 * t + 2]);
+            double d2 = (q - p).mag2();
+            if (d2 < best2) {
+                best2 = d2;
+                bestTri = t;
+            }
+        }
+    }
+    if (tri) *tri = bestTri;
+    return bestTri < 0 ? maxDist : scale * std::sqrt(best2);
+}
+
+EInside MeshSolid::Inside(const G4ThreeVector& p) const
+{
+    const double halfTol = 0.5 * kCarTolerance;
+    if (BoxDistance(p) > halfTol) return kOutside;
+
+    int tri = -1;
+    Safety(p, 1.0, halfTol, &tri);
+    if (tri >= 0) return kSurface;
+
+    // Ray parity; a hit close to a triangle edge may be counted by both
+    // neighbours (or neither), so such rays are retried along another
+    // direction. Irrational-looking directions avoid the edges and face
+    // diagonals of axis-aligned meshes; if all rays are ambiguous, vote
+    static const G4ThreeVector dirs[] = {
+        G4ThreeVector(0.5358, 0.7136, 0.4514).unit(),
+        G4ThreeVector(-0.3119, 0.5657, -0.7634).unit(),
+        G4ThreeVector(0.8271, -0.4463, 0.3411).unit(),
+        G4ThreeVector(-0.6127, -0.2846, 0.7373).unit(),
+        G4ThreeVector(0.1753, -0.9218, -0.3459).unit(),
+    };
+    const double eps = 1e-9;
+    int votes = 0;
+    for (const auto& dir : dirs) {
+        bool ambiguous = false;
+        int crossings = 0;
+        double tMax = kInf;
+        Intersect(p, dir, 0.0, tMax, [&](int, double, double u, double w, double&) {
+            ++crossings;
+            if (u < eps || w < eps || u + w > 1.0 - eps) ambiguous = true;
+        });
+        if (!ambiguous) return (crossings % 2) ? kInside : kOutside;
+        votes += (crossings % 2) ? 1 : -1;
+    }
+    return votes > 0 ? kInside : kOutside;
+}
+
+G4ThreeVector MeshSolid::SurfaceNormal(const G4ThreeVector& p) const
+{
+    int tri = -1;
+    Safety(p, 1.0, kInfinity, &tri);
+    return tri < 0 ? G4ThreeVector(0, 0, 1) : normals[tri];
+}
+
+G4double MeshSolid::DistanceToIn(const G4ThreeVector& p, const G4ThreeVector& v) const
+{
+    double dist = NearestHit(p, v, -1);
+    return dist == kInf ? kInfinity : dist;
+}
+
+G4double MeshSolid::DistanceToIn(const G4ThreeVector& p) const
+{
+    // Far from the mesh the bounding box is a good enough (under)estimate
+    double box = BoxDistance(p);
+    return box > 0.0 ? box : Safety(p, kSafetyScale, kInfinity);
+}
+
+G4double MeshSolid::DistanceToOut(const G4ThreeVector& p, const G4ThreeVector& v,
+                                  const G4bool calcNorm, G4bool* validNorm,
+                                  G4ThreeVector* n) const
+{
+    int tri = -1;
+    double dist = NearestHit(p, v, +1, &tri);
+
+    // A ray through an edge or vertex can slip between the facets sharing
+    // it; retry once on a parallel ray shifted sideways by the tolerance
+    if (tri < 0)
+        dist = NearestHit(p + kCarTolerance * v.orthogonal().unit(), v, +1, &tri);
+
+    if (calcNorm) {
+        // The mesh is not convex: the solid may lie on both sides of the exit plane
+        if (validNorm) *validNorm = false;
+        if (n && tri >= 0) *n = normals[tri];
+    }
+    if (tri >= 0) return dist;
+
+    // Still no exit: step by the exact safety so the track keeps moving,
+    // and report it the way G4TessellatedSolid does
+    long long missed = ++gMissedExits;
+    if (missed <= 10) {
+        std::ostringstream message;
+        message << "No exit facet found for a point inside " << GetName() << " at " << p
+                << " along " << v << "; stepping by the safety distance instead ("
+                << missed << (missed == 10 ? " so far, further cases not reported)" : " so far)");
+        G4Exception("MeshSolid::DistanceToOut", "MeshSolid002", JustWarning, message.str().c_str());
+    }
+    if (calcNorm && n)
+        *n = SurfaceNormal(p);
+    return Safety(p, 1.0, kInfinity);
+}
+
+G4double MeshSolid::DistanceToOut(const G4ThreeVector& p) const
+{
+    return Safety(p, kSafetyScale, kInfinity);
+}
+
+void MeshSolid::BoundingLimits(G4ThreeVector& pMin, G4ThreeVector& pMax) const
+{
+    pMin = bmin;
+    pMax = bmax;
+}
+
+G4bool MeshSolid::CalculateExtent(const EAxis pAxis, const G4VoxelLimits& pVoxelLimit,
+                                  const G4AffineTransform& pTransform,
+                                  G4double& pMin, G4double& pMax) const
+{
+    G4BoundingEnvelope bbox(bmin, bmax);
+    return bbox.CalculateExtent(pAxis, pVoxelLimit, pTransform, pMin, pMax);
+}
+
+G4double MeshSolid::GetCubicVolume()
+{
+    if (volume < 0.0) {
+        // Divergence theorem over the closed surface
+        double sum = 0.0;
+        for (size_t t = 0; t < normals.size(); ++t)
+            sum += vertices[3 * t].dot(vertices[3 * t + 1].cross(vertices[3 * t + 2]));
+        volume = sum / 6.0;
+    }
+    return volume;
+}
+
+G4double MeshSolid::GetSurfaceArea()
+{
+    return cumulativeArea.empty() ? 0.0 : cumulativeArea.back();
+}
+
+G4ThreeVector MeshSolid::GetPointOnSurface() const
+{
+    double r = G4UniformRand() * cumulativeArea.back();
+    size_t t = std::lower_bound(cumulativeArea.begin(), cumulativeArea.end(), r)
+               - cumulativeArea.begin();
+    t = std::min(t, normals.size() - 1);
+    double u = G4UniformRand(), w = G4UniformRand();
+    if (u + w > 1.0) { u = 1.0 - u; w = 1.0 - w; }
+    const auto& a = vertices[3 * t];
+    return a + (vertices[3 * t + 1] - a) * u + (vertices[3 * t + 2] - a) * w;
+}
+
+std::ostream& MeshSolid::StreamInfo(std::ostream& os) const
+{
+    os << "-----------------------------------------------------------\n"
+       << "    *** Dump for solid - " << GetName() << " ***\n"
+       << "    ===================================================\n"
+       << " Solid type: MeshSolid\n"
+       << " Triangles: " << normals.size() << ", BVH nodes: " << nodes.size() << "\n"
+       << " Bounds: " << bmin << " -> " << bmax << "\n"
+       << "-----------------------------------------------------------\n";
+    return os;
+}
+
+void MeshSolid::DescribeYourselfTo(G4VGraphicsScene& scene) const
+{
+    scene.AddSolid(*this);
+}
+
+G4Polyhedron* MeshSolid::CreatePolyhedron() const
+{
+    const int nTri = int(normals.size());
+    auto* poly = new G4PolyhedronArbitrary(3 * nTri, nTri);
+    for (const auto& v : vertices)
+        poly->AddVertex(v);
+    for (int t = 0; t < nTri; ++t)
+        poly->AddFacet(3 * t + 1, 3 * t + 2, 3 * t + 3);
+    poly->SetReferences();
+    return poly;
+}
@@ -0,0 +1,160 @@
+/*
+ * src/MeshVoxelizer.cc
+ * Inside/outside voxelization of a tessellated mesh by ray parity
+ */
+
+#include "MeshVoxelizer.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+
+namespace {
+// Rays along +x at y = y0 + (i + 0.5) * sy, z = z0 + (j + 0.5) * sz for
+// i < ny, j < nz. They are nudged off those points so they never graze an
+// edge or vertex of axis-aligned facets exactly (which would count a
+// crossing twice)
+struct RayLattice {
+    double y0, sy, z0, sz;
+    int ny, nz;
+};
+
+// emit(i, j, x) for every lattice ray crossing triangle abc
+template <typename Emit>
+void CrossTriangle(const G4ThreeVector& a, const G4ThreeVector& b, const G4ThreeVector& c,
+                   const RayLattice& L, Emit&& emit)
+{
+    // Signed area in the yz projection; edge-on facets never cross a ray
+    double area = (b.y() - a.y()) * (c.z() - a.z()) - (c.y() - a.y()) * (b.z() - a.z());
+    if (area == 0.0) return;
+
+    auto range = [](double lo, double hi, double min, double d, int n, int& i0, int& i1) {
+        i0 = std::max(0, int(std::ceil((lo - min) / d - 0.5)));
+        i1 = std::min(n - 1, int(std::floor((hi - min) / d - 0.5)));
+    };
+    int i0, i1, j0, j1;
+    range(std::min({a.y(), b.y(), c.y()}), std::max({a.y(), b.y(), c.y()}),
+          L.y0, L.sy, L.ny, i0, i1);
+    range(std::min({a.z(), b.z(), c.z()}), std::max({a.z(), b.z(), c.z()}),
+          L.z0, L.sz, L.nz, j0, j1);
+
+    const double ey = 1e-6 * L.sy, ez = 0.7e-6 * L.sz;
+    for (int j = j0; j <= j1; ++j) {
+        double z = L.z0 + (j + 0.5) * L.sz + ez;
+        for (int i = i0; i <= i1; ++i) {
+            double y = L.y0 + (i + 0.5) * L.sy + ey;
+            // Barycentric weights of (y, z); all share the sign of area
+            double w0 = (b.y() - y) * (c.z() - z) - (c.y() - y) * (b.z() - z);
+            double w1 = (c.y() - y) * (a.z() - z) - (a.y() - y) * (c.z() - z);
+            double w2 = area - w0 - w1;
+            bool inside = area > 0.0 ? (w0 > 0.0 && w1 > 0.0 && w2 > 0.0)
+                                     : (w0 < 0.0 && w1 < 0.0 && w2 < 0.0);
+            if (inside)
+                emit(i, j, (w0 * a.x() + w1 * b.x() + w2 * c.x()) / area);
+        }
+    }
+}
+}
+
+std::vector<uint8_t> VoxelizeMesh(const std::vector<G4ThreeVector>& triangles,
+                                 const G4ThreeVector& offset,
+                                 const VoxelLayout& g)
+{
+    // One ray through every (iy, iz) row of voxel centres; the mesh
+    // crossings along it are collected per row, then filled by parity
+    const RayLattice lattice{g.ymin, g.dy, g.zmin, g.dz, g.NY, g.NZ};
+    std::vector<std::vector<double>> rows(size_t(g.NY) * g.NZ);
+    for (size_t i = 0; i + 2 < triangles.size(); i += 3) {
+        CrossTriangle(triangles[i] + offset, triangles[i + 1] + offset, triangles[i + 2] + offset,
+                      lattice, [&](int iy, int iz, double x) {
+                          rows[iy + size_t(g.NY) * iz].push_back(x);
+                      });
+    }
+
+    std::vector<uint8_t> inside(size_t(g.NX) * g.NY * g.NZ, 0);
+    for (size_t r = 0; r < rows.size(); ++r) {
+        auto& xs = rows[r];
+        std::sort(xs.begin(), xs.end());
+        size_t base = r * g.NX;
+        // Pairs of crossings bound the inside; an odd leftover (open mesh)
+        // is dropped
+        for (size_t k = 0; k + 1 < xs.size(); k += 2) {
+            int ix0 = std::max(0, int(std::ceil((xs[k] - g.xmin) / g.dx - 0.5)));
+            int ix1 = std::min(g.NX - 1, int(std::floor((xs[k + 1] - g.xmin) / g.dx - 0.5)));
+            for (int ix = ix0; ix <= ix1; ++ix)
+                inside[base + ix] = 1;
+        }
+    }
+    return inside;
+}
+
+std::vector<float> MeshOccupancy(const std::vector<G4ThreeVector>& triangles,
+                                 const G4ThreeVector& offset,
+                                 const VoxelLayout& g, int samples)
+{
+    const int s = std::max(1, samples);
+    const int nTri = int(triangles.size() / 3);
+
+    // Triangles binned by the z-planes of voxels they overlap
+    std::vector<std::vector<int>> planes(g.NZ);
+    for (int t = 0; t < nTri; ++t) {
+        double lo = std::min({triangles[3 * t].z(), triangles[3 * t + 1].z(), triangles[3 * t + 2].z()});
+        double hi = std::max({triangles[3 * t].z(), triangles[3 * t + 1].z(), triangles[3 * t + 2].z()});
+        int iz0 = std::max(0, int(std::floor((lo + offset.z() - g.zmin) / g.dz)));
+        int iz1 = std::min(g.NZ - 1, int(std::floor((hi + offset.z() - g.zmin) / g.dz)));
+        for (int iz = iz0; iz <= iz1; ++iz)
+            planes[iz].push_back(t);
+    }
+
+    // Threads take whole z-planes, so each one writes its own slab of the
+    // result. Inside a plane, s x s rays per voxel row add the length of
+    // their inside intervals clipped to each voxel
+    std::vector<float> occupancy(size_t(g.NX) * g.NY * g.NZ, 0.0f);
+    const float weight = 1.0f / float(s * s);
+    std::atomic<int> nextPlane{0};
+    auto work = [&]() {
+        const int raysY = g.NY * s;
+        std::vector<std::vector<double>> rows(size_t(raysY) * s);
+        for (int iz; (iz = nextPlane++) < g.NZ;) {
+            if (planes[iz].empty()) continue;
+            for (auto& r : rows) r.clear();
+
+            const RayLattice lattice{g.ymin, g.dy / s, g.zmin + iz * g.dz, g.dz / s, raysY, s};
+            for (int t : planes[iz]) {
+                CrossTriangle(triangles[3 * t] + offset, triangles[3 * t + 1] + offset,
+                              triangles[3 * t + 2] + offset, lattice,
+                              [&](int jy, int jz, double x) {
+                                  rows[jy + size_t(raysY) * jz].push_back(x);
+                              });
+            }
+
+            for (size_t r = 0; r < rows.size(); ++r) {
+                auto& xs = rows[r];
+                if (xs.size() < 2) continue;
+                std::sort(xs.begin(), xs.end());
+                int iy = int(r % raysY) / s;
+                float* row = &occupancy[size_t(g.NX) * (iy + size_t(g.NY) * iz)];
+                for (size_t k = 0; k + 1 < xs.size(); k += 2) {
+                    double u0 = (xs[k] - g.xmin) / g.dx, u1 = (xs[k + 1] - g.xmin) / g.dx;
+                    int ix0 = std::max(0, int(std::floor(u0)));
+                    int ix1 = std::min(g.NX - 1, int(std::floor(u1)));
+                    for (int ix = ix0; ix <= ix1; ++ix) {
+                        double len = std::min(u1, ix + 1.0) - std::max(u0, double(ix));
+                        if (len > 0.0) row[ix] += float(len) * weight;
+                    }
+                }
+            }
+        }
+    };
+
+    unsigned nThreads = std::max(1u, std::min(std::thread::hardware_concurrency(), unsigned(g.NZ)));
+    std::vector<std::thread> pool;
+    for (unsigned w = 1; w < nThreads; ++w)
+        pool.emplace_back(work);
+    work();
+    for (auto& t : pool) t.join();
+
+    for (auto& f : occupancy) f = std::min(f, 1.0f);
+    return occupancy;
+}
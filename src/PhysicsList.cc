@@ -6,17 +6,26 @@
 
 #include "G4EmLivermorePhysics.hh"
 #include "G4EmParameters.hh"
+#include "G4StepLimiterPhysics.hh"
 #include "G4SystemOfUnits.hh"
 
-PhysicsList::PhysicsList()
+PhysicsList::PhysicsList(const PhysicsConfig& cfg)
 {
-    // Default cut values 
-    defaultCutValue = 0.1*mm;
+    // Cut for the air world outside the scoring region
+    defaultCutValue = cfg.world_cut_mm*mm;
     SetVerboseLevel(1);
 
     // Electromagnetic physics
     RegisterPhysics(new G4EmLivermorePhysics());
 
+    // G4UserSpecialCuts applies the world's EnvelopeLimits; by default it
+    // only goes to neutral particles, the electrons need it too
+    if (cfg.kill_outside) {
+        auto* limiter = new G4StepLimiterPhysics();
+        limiter->SetApplyToAll(true);
+        RegisterPhysics(limiter);
+    }
+
     // Enable detailed atomic de-excitation
     auto* emParams = G4EmParameters::Instance();
     emParams->SetFluo(true);
@@ -3,11 +3,14 @@
  */
 
 #include "PrimaryGeneratorAction.hh"
+#include "DetectorConstruction.hh"
 
 #include "G4ParticleGun.hh"
 #include "G4ParticleTable.hh"
 #include "G4SystemOfUnits.hh"
 #include "G4Event.hh"
+#include "G4PrimaryVertex.hh"
+#include "G4RunManager.hh"
 #include "G4ThreeVector.hh"
 #include "Randomize.hh"
 
@@ -15,8 +18,10 @@
 #include <random>
 #include <cmath>
 #include <atomic>
+#include <limits>
 
 std::atomic<long long> PrimaryGeneratorAction::eventOffset{0};
+std::atomic<long long> PrimaryGeneratorAction::culled{0};
 
 PrimaryGeneratorAction::PrimaryGeneratorAction(const SceneConfig& cfg)
     : config(cfg)
@@ -28,6 +33,17 @@ PrimaryGeneratorAction::PrimaryGeneratorAction(const SceneConfig& cfg)
     fParticleGun->SetParticleDefinition(gamma);
 
     fParticleGun->SetParticleEnergy(config.beam.mono_energy_keV * keV);
+
+    // Polychromatic: one alias draw per photon, whatever the line count
+    if (!config.beam.spectrum_keV.empty()) {
+        for (double e : config.beam.spectrum_keV) energies.push_back(e * keV);
+        spectrum = AliasTable(config.beam.spectrum_weight);
+        randomsPerPhoton = 3;
+    }
+
+    DetectorConstruction::ScoringEnvelope(config, envelopeLo, envelopeHi);
+    envelopeLo *= mm;
+    envelopeHi *= mm;
 }
 
 PrimaryGeneratorAction::~PrimaryGeneratorAction()
@@ -36,6 +52,137 @@ PrimaryGeneratorAction::~PrimaryGeneratorAction()
 }
 
 void PrimaryGeneratorAction::GeneratePrimaries(G4Event* event)
+{
+    if (!kernel) BuildPoses();
+    (this->*kernel)(event);
+}
+
+void PrimaryGeneratorAction::BuildPoses()
+{
+    const auto& a = config.acquisition;
+    double span = a.end_angle_deg - a.start_angle_deg;
+    int projections = std::max(1, a.num_projections);
+    bool fly = a.mode == "fly";
+
+    // Single projection or zero span: keep the beam fixed at start_angle.
+    // Open-ended runs (convergence stop) must cover all angles in every
+    // stretch of events, so they walk them in an interleaved order
+    Schedule schedule;
+    if (!fly && (projections <= 1 || span == 0.0))
+        schedule = Schedule::Fixed;
+    else if (a.interleave)
+        schedule = fly ? Schedule::FlyInterleaved : Schedule::StepInterleaved;
+    else
+        schedule = fly ? Schedule::Fly : Schedule::Step;
+
+    // Fly scans sweep continuously; the angle is looked up in a table at
+    // fly_step_deg resolution instead of rotating the beamline per event
+    int n = 1;
+    if (fly)
+        n = std::max(2, int(std::ceil(std::abs(span) / std::max(1e-6, a.fly_step_deg))) + 1);
+    else if (schedule != Schedule::Fixed)
+        n = projections;
+
+    poses.clear();
+    poses.reserve(n);
+    for (int k = 0; k < n; ++k)
+        poses.push_back(MakePose(n > 1 ? a.start_angle_deg + k * span / (n - 1) : a.start_angle_deg));
+
+    // Angles follow the photon count, so a step projection may end inside
+    // an event and fly scans stay continuous across its photons
+    const int photons = config.beam.photons_per_event;
+    totalPhotons = a.total_events * photons;
+    photonsPerProjection = std::max<long long>(1, std::max<long long>(1, totalPhotons) / projections);
+    randoms.resize(size_t(randomsPerPhoton) * photons);
+
+    if (config.beam.type == "point")
+        SelectKernel<Beam::Point>(schedule);
+    else
+        SelectKernel<Beam::Parallel>(schedule);
+}
+
+template <PrimaryGeneratorAction::Beam B>
+void PrimaryGeneratorAction::SelectKernel(Schedule schedule)
+{
+    switch (schedule) {
+    case Schedule::Fixed:           kernel = &PrimaryGeneratorAction::Shoot<B, Schedule::Fixed>; break;
+    case Schedule::Step:            kernel = &PrimaryGeneratorAction::Shoot<B, Schedule::Step>; break;
+    case Schedule::StepInterleaved: kernel = &PrimaryGeneratorAction::Shoot<B, Schedule::StepInterleaved>; break;
+    case Schedule::Fly:             kernel = &PrimaryGeneratorAction::Shoot<B, Schedule::Fly>; break;
+    case Schedule::FlyInterleaved:  kernel = &PrimaryGeneratorAction::Shoot<B, Schedule::FlyInterleaved>; break;
+    }
+}
+
+template <PrimaryGeneratorAction::Schedule S>
+size_t PrimaryGeneratorAction::PoseIndex(long long photonId) const
+{
+    const long long last = static_cast<long long>(poses.size()) - 1;
+    if constexpr (S == Schedule::Fixed) {
+        (void)photonId;
+        return 0;
+    } else if constexpr (S == Schedule::Step) {
+        return size_t(std::min(last, photonId / photonsPerProjection));
+    } else if constexpr (S == Schedule::StepInterleaved) {
+        return size_t(photonId % static_cast<long long>(poses.size()));
+    } else if constexpr (S == Schedule::Fly) {
+        double frac = totalPhotons > 1 ? std::min(1.0, photonId / static_cast<double>(totalPhotons - 1)) : 0.0;
+        return size_t(std::llround(frac * last));
+    } else {
+        // Golden-ratio sequence: low-discrepancy fill of [start, end]
+        double frac = std::fmod(photonId * 0.6180339887498949, 1.0);
+        return size_t(std::llround(frac * last));
+    }
+}
+
+template <PrimaryGeneratorAction::Beam B, PrimaryGeneratorAction::Schedule S>
+void PrimaryGeneratorAction::Shoot(G4Event* event)
+{
+    const int stride = randomsPerPhoton;
+    const int photons = int(randoms.size()) / stride;
+    long long firstPhoton = 0;
+    if constexpr (S != Schedule::Fixed)
+        firstPhoton = (eventOffset.load(std::memory_order_relaxed) + event->GetEventID()) * photons;
+
+    // One engine call for all of the event's photons (u, v[, energy])
+    G4Random::getTheEngine()->flatArray(int(randoms.size()), randoms.data());
+
+    for (int k = 0; k < photons; ++k) {
+        const Pose& p = poses[PoseIndex<S>(firstPhoton + k)];
+        const double* r = &randoms[size_t(stride) * k];
+
+        // Sample only the window that can reach the objects; each photon
+        // then stands for weight photons of the full footprint
+        double u = (p.u0 + r[0] * p.du) * mm;
+        double v = (p.v0 + r[1] * p.dv) * mm;
+
+        G4ThreeVector pos = p.src, dir = p.dir;
+        if constexpr (B == Beam::Point) {
+            // Point source: position at source, direction to a random point on detector plane
+            dir = (p.det + u * p.u_hat + v * p.v_hat - p.src).unit();
+        } else {
+            // Parallel beam: position sampled on plane perpendicular to dir at the source
+            pos = p.src + u * p.u_hat + v * p.v_hat;
+        }
+
+        // Nothing is scored outside the envelope and tracks leaving it are
+        // killed, so a ray that misses it would only cost transport. It gets
+        // no vertex but still counts towards normalization and uncertainty
+        if (config.physics.cull_primaries && Misses(pos, dir)) {
+            culled.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        if (!energies.empty())
+            fParticleGun->SetParticleEnergy(energies[spectrum.Sample(r[2])]);
+        fParticleGun->SetParticlePosition(pos);
+        fParticleGun->SetParticleMomentumDirection(dir);
+        fParticleGun->GeneratePrimaryVertex(event);
+        if (p.weight != 1.0)
+            event->GetPrimaryVertex(event->GetNumberOfPrimaryVertex() - 1)->SetWeight(p.weight);
+    }
+}
+
+PrimaryGeneratorAction::Pose PrimaryGeneratorAction::MakePose(double angle_deg) const
 {
     const auto& b = config.beam;
     const auto& a = config.acquisition;
@@ -47,35 +194,6 @@ void PrimaryGeneratorAction::GeneratePrimaries(G4Event* event)
         return v * c + axisUnit.cross(v) * s + axisUnit * (axisUnit.dot(v)) * (1.0 - c);
     };
 
-    // Compute projection angle based on acquisition mode
-    auto angle_deg = [&]() {
-        double span = a.end_angle_deg - a.start_angle_deg;
-        long long totalEvents = std::max<long long>(1, a.total_events);
-
-        // Single projection or zero span: keep the beam fixed at start_angle
-        if (a.mode != "fly" && (a.num_projections <= 1 || span == 0.0)) {
-            return a.start_angle_deg;
-        }
-
-        if (a.mode == "fly") {
-            double frac = 0.0;
-            if (totalEvents > 1) {
-                long long globalId = eventOffset.load() + event->GetEventID();
-                frac = std::min(1.0, globalId / static_cast<double>(totalEvents - 1));
-            }
-            return a.start_angle_deg + frac * span;
-        }
-
-        // default: step-and-shoot with multiple projections
-        int projections = std::max(1, a.num_projections);
-        long long eventsPerProj = std::max<long long>(1, totalEvents / projections);
-        long long globalId = eventOffset.load() + event->GetEventID();
-        long long projIdx = globalId / eventsPerProj;
-        projIdx = std::min<long long>(projections - 1, projIdx);
-        double frac = projections > 1 ? projIdx / static_cast<double>(projections - 1) : 0.0;
-        return a.start_angle_deg + frac * span;
-    }();
-
     double angle_rad = angle_deg * deg;
 
     G4ThreeVector axis(a.rotation_axis[0], a.rotation_axis[1], a.rotation_axis[2]);
@@ -99,60 +217,109 @@ void PrimaryGeneratorAction::GeneratePrimaries(G4Event* event)
         return pivot + rotate(v - pivot, axis, angle_rad);
     };
 
-    G4ThreeVector src = rotateAboutPivot(src0);
-    G4ThreeVector det = rotateAboutPivot(det0);
-    G4ThreeVector up  = rotate(up0, axis, angle_rad).unit();
+    Pose pose;
+    pose.src = rotateAboutPivot(src0);
+    pose.det = rotateAboutPivot(det0);
+    G4ThreeVector up = rotate(up0, axis, angle_rad).unit();
+    pose.dir = (pose.det - pose.src).unit();
 
-    G4ThreeVector dir = (det - src).unit();
-
-    // Uniform beam cross-section: sample within detector area
-    double sx = b.detector_pixel_size_mm[0] * b.detector_pixels[0]; // full size in mm
-    double sy = b.detector_pixel_size_mm[1] * b.detector_pixels[1];
+    // Build orthonormal basis (dir, u_hat, v_hat)
+    G4ThreeVector u_hat = up.cross(pose.dir);
+    if (u_hat.mag2() == 0.0) {
+        // Fallback if up is parallel to dir
+        G4ThreeVector fallback(0, 0, 1);
+        if (std::abs(pose.dir.dot(fallback)) > 0.9) {
+            fallback = G4ThreeVector(0, 1, 0);
+        }
+        u_hat = fallback.cross(pose.dir);
+    }
+    pose.u_hat = u_hat.unit();
+    pose.v_hat = pose.dir.cross(pose.u_hat).unit();
 
     /*
+     * Uniform beam cross-section over the detector area.
      * With 2048px x 0.05mm, beam footprint ~102mm wide
      * > larger than the default 20mm voxel cube
      * > cube is fully illuminated
-     * > lots of photons miss for nothing
+     * > lots of photons miss for nothing: the silhouette window and the
+     *   cull test take care of those
      */
+    double sx = b.detector_pixel_size_mm[0] * b.detector_pixels[0]; // full size in mm
+    double sy = b.detector_pixel_size_mm[1] * b.detector_pixels[1];
+    pose.u0 = -0.5 * sx;
+    pose.du = sx;
+    pose.v0 = -0.5 * sy;
+    pose.dv = sy;
+    pose.weight = 1.0;
+    if (b.footprint == "silhouette")
+        Silhouette(pose, sx, sy);
+    return pose;
+}
 
-    auto sample = [](double size_mm) {
-        return (G4UniformRand() - 0.5) * size_mm * mm;
-    };
-
-    // Build orthonormal basis (dir, u_hat, v_hat)
-    G4ThreeVector u_hat = up.cross(dir);
-    if (u_hat.mag2() == 0.0) {
-        // Fallback if up is parallel to dir
-        G4ThreeVector fallback(0, 0, 1);
-        if (std::abs(dir.dot(fallback)) > 0.9) {
-            fallback = G4ThreeVector(0, 1, 0);
+bool PrimaryGeneratorAction::Misses(const G4ThreeVector& p, const G4ThreeVector& d) const
+{
+    // Slab test over t >= 0
+    double t0 = 0.0, t1 = std::numeric_limits<double>::infinity();
+    for (int a = 0; a < 3; ++a) {
+        if (d[a] == 0.0) {
+            if (p[a] < envelopeLo[a] || p[a] > envelopeHi[a]) return true;
+            continue;
         }
-        u_hat = fallback.cross(dir);
-    }
-    u_hat = u_hat.unit();
-    G4ThreeVector v_hat = dir.cross(u_hat).unit();
-
-    double u = sample(sx);
-    double v = sample(sy);
-
-    if (b.type == "point") {
-        // Point source: position at source, direction to a random point on detector plane
-        G4ThreeVector target = det + u * u_hat + v * v_hat;
-        G4ThreeVector dir_point = (target - src).unit();
-        fParticleGun->SetParticlePosition(src);
-        fParticleGun->SetParticleMomentumDirection(dir_point);
-    } else {
-        // Parallel beam: position sampled on plane perpendicular to dir at the source
-        G4ThreeVector pos = src + u * u_hat + v * v_hat;
-        fParticleGun->SetParticlePosition(pos);
-        fParticleGun->SetParticleMomentumDirection(dir);
+        double ta = (envelopeLo[a] - p[a]) / d[a];
+        double tb = (envelopeHi[a] - p[a]) / d[a];
+        t0 = std::max(t0, std::min(ta, tb));
+        t1 = std::min(t1, std::max(ta, tb));
     }
+    return t0 > t1;
+}
 
-    fParticleGun->GeneratePrimaryVertex(event);
+void PrimaryGeneratorAction::Silhouette(Pose& pose, double sx, double sy) const
+{
+    // Built on the master; workers share the same construction
+    auto* detector = static_cast<const DetectorConstruction*>(
+        G4RunManager::GetRunManager()->GetUserDetectorConstruction());
+    G4ThreeVector lo, hi;
+    if (!detector || !detector->ObjectBounds(lo, hi)) return;
+
+    const G4ThreeVector toDet = pose.det - pose.src;
+    double u0 = std::numeric_limits<double>::infinity(), u1 = -u0;
+    double v0 = u0, v1 = -u0;
+    for (int c = 0; c < 8; ++c) {
+        G4ThreeVector corner((c & 1 ? hi.x() : lo.x()) * mm,
+                             (c & 2 ? hi.y() : lo.y()) * mm,
+                             (c & 4 ? hi.z() : lo.z()) * mm);
+        G4ThreeVector onPlane = corner - pose.src;
+        if (config.beam.type == "point") {
+            // Central projection from the source onto the detector plane
+            double depth = onPlane.dot(pose.dir);
+            if (depth <= 0.0) return;   // source inside or past the objects
+            onPlane = onPlane * (toDet.dot(pose.dir) / depth) - toDet;
+        }
+        double u = onPlane.dot(pose.u_hat) / mm, v = onPlane.dot(pose.v_hat) / mm;
+        u0 = std::min(u0, u);
+        u1 = std::max(u1, u);
+        v0 = std::min(v0, v);
+        v1 = std::max(v1, v);
+    }
+    u0 = std::max(u0, -0.5 * sx);
+    u1 = std::min(u1, 0.5 * sx);
+    v0 = std::max(v0, -0.5 * sy);
+    v1 = std::min(v1, 0.5 * sy);
+    // Objects outside the footprint: keep it (every ray gets culled)
+    if (u0 >= u1 || v0 >= v1) return;
+    pose.u0 = u0;
+    pose.du = u1 - u0;
+    pose.v0 = v0;
+    pose.dv = v1 - v0;
+    pose.weight = (u1 - u0) * (v1 - v0) / (sx * sy);
 }
 
 void PrimaryGeneratorAction::SetEventOffset(long long offset)
 {
     eventOffset.store(offset);
 }
+
+long long PrimaryGeneratorAction::CulledPrimaries()
+{
+    return culled.load();
+}
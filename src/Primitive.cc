@@ -0,0 +1,183 @@
+/*
+ * src/Primitive.cc
+ * Analytic object shapes: solids, containment, volume and occupancy
+ */
+
+#include "Primitive.hh"
+
+#include "G4Box.hh"
+#include "G4Orb.hh"
+#include "G4PhysicalConstants.hh"
+#include "G4RotationMatrix.hh"
+#include "G4Sphere.hh"
+#include "G4SubtractionSolid.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4Tubs.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+
+namespace {
+// Offset from the centre split into the coordinate along the axis and the
+// two across it
+void AxisFrame(const PrimitiveConfig& p, const G4ThreeVector& point, double& along,
+               double& u, double& v)
+{
+    G4ThreeVector d = point - G4ThreeVector(p.position_mm[0], p.position_mm[1], p.position_mm[2]);
+    int a = p.axis - 'x';
+    along = d[a];
+    u = d[(a + 1) % 3];
+    v = d[(a + 2) % 3];
+}
+}
+
+G4VSolid* BuildPrimitiveSolid(const G4String& name, const PrimitiveConfig& p)
+{
+    const double w = p.wall_mm;
+    if (p.type == "box") {
+        const double hx = 0.5 * p.size_mm[0], hy = 0.5 * p.size_mm[1], hz = 0.5 * p.size_mm[2];
+        auto* outer = new G4Box(name, hx * mm, hy * mm, hz * mm);
+        if (w <= 0.0) return outer;
+        auto* inner = new G4Box(name + "Inner", (hx - w) * mm, (hy - w) * mm, (hz - w) * mm);
+        return new G4SubtractionSolid(name, outer, inner);
+    }
+    if (p.type == "sphere") {
+        if (w <= 0.0) return new G4Orb(name, p.radius_mm * mm);
+        return new G4Sphere(name, (p.radius_mm - w) * mm, p.radius_mm * mm, 0.0, twopi, 0.0, pi);
+    }
+    const double hl = 0.5 * p.length_mm;
+    if (p.type == "capillary")
+        return new G4Tubs(name, (p.radius_mm - w) * mm, p.radius_mm * mm, hl * mm, 0.0, twopi);
+
+    // Cylinder; a wall makes a closed vial
+    auto* outer = new G4Tubs(name, 0.0, p.radius_mm * mm, hl * mm, 0.0, twopi);
+    if (w <= 0.0) return outer;
+    auto* inner = new G4Tubs(name + "Inner", 0.0, (p.radius_mm - w) * mm, (hl - w) * mm, 0.0, twopi);
+    return new G4SubtractionSolid(name, outer, inner);
+}
+
+G4RotationMatrix* PrimitiveRotation(const PrimitiveConfig& p)
+{
+    if (p.type == "box" || p.type == "sphere" || p.axis == 'z') return nullptr;
+    auto* rot = new G4RotationMatrix();
+    if (p.axis == 'x') rot->rotateY(90.0 * deg);
+    else rot->rotateX(90.0 * deg);
+    return rot;
+}
+
+bool PrimitiveContains(const PrimitiveConfig& p, const G4ThreeVector& point)
+{
+    const double w = p.wall_mm;
+    if (p.type == "box") {
+        G4ThreeVector d = point - G4ThreeVector(p.position_mm[0], p.position_mm[1], p.position_mm[2]);
+        bool in = true, core = w > 0.0;
+        for (int a = 0; a < 3; ++a) {
+            double h = 0.5 * p.size_mm[a], x = std::abs(d[a]);
+            in = in && x <= h;
+            core = core && x < h - w;
+        }
+        return in && !core;
+    }
+    if (p.type == "sphere") {
+        G4ThreeVector d = point - G4ThreeVector(p.position_mm[0], p.position_mm[1], p.position_mm[2]);
+        double r2 = d.mag2(), rIn = p.radius_mm - w;
+        return r2 <= p.radius_mm * p.radius_mm && (w <= 0.0 || r2 >= rIn * rIn);
+    }
+    double along, u, v;
+    AxisFrame(p, point, along, u, v);
+    double r2 = u * u + v * v, rIn = p.radius_mm - w, hl = 0.5 * p.length_mm;
+    if (r2 > p.radius_mm * p.radius_mm || std::abs(along) > hl) return false;
+    if (w <= 0.0) return true;
+    if (p.type == "capillary") return r2 >= rIn * rIn;
+    return r2 >= rIn * rIn || std::abs(along) >= hl - w;
+}
+
+double PrimitiveVolume(const PrimitiveConfig& p)
+{
+    const double w = p.wall_mm;
+    if (p.type == "box") {
+        double v = p.size_mm[0] * p.size_mm[1] * p.size_mm[2];
+        if (w > 0.0) v -= (p.size_mm[0] - 2 * w) * (p.size_mm[1] - 2 * w) * (p.size_mm[2] - 2 * w);
+        return v;
+    }
+    const double r = p.radius_mm, rIn = r - w;
+    if (p.type == "sphere")
+        return 4.0 / 3.0 * pi * (r * r * r - (w > 0.0 ? rIn * rIn * rIn : 0.0));
+    if (p.type == "capillary")
+        return pi * (r * r - rIn * rIn) * p.length_mm;
+    double v = pi * r * r * p.length_mm;
+    if (w > 0.0) v -= pi * rIn * rIn * (p.length_mm - 2 * w);
+    return v;
+}
+
+void PrimitiveBounds(const PrimitiveConfig& p, G4ThreeVector& lo, G4ThreeVector& hi)
+{
+    G4ThreeVector half;
+    if (p.type == "box") {
+        half.set(0.5 * p.size_mm[0], 0.5 * p.size_mm[1], 0.5 * p.size_mm[2]);
+    } else {
+        half.set(p.radius_mm, p.radius_mm, p.radius_mm);
+        if (p.type != "sphere") {
+            if (p.axis == 'x') half.setX(0.5 * p.length_mm);
+            else if (p.axis == 'y') half.setY(0.5 * p.length_mm);
+            else half.setZ(0.5 * p.length_mm);
+        }
+    }
+    G4ThreeVector c(p.position_mm[0], p.position_mm[1], p.position_mm[2]);
+    lo = c - half;
+    hi = c + half;
+}
+
+std::vector<float> PrimitiveOccupancy(const PrimitiveConfig& p, const VoxelLayout& g,
+                                      int samples)
+{
+    const int s = std::max(1, samples);
+    std::vector<float> occupancy(size_t(g.NX) * g.NY * g.NZ, 0.0f);
+
+    // Voxel range overlapping the bounds
+    G4ThreeVector lo, hi;
+    PrimitiveBounds(p, lo, hi);
+    const int n[3] = {g.NX, g.NY, g.NZ};
+    const double min[3] = {g.xmin, g.ymin, g.zmin};
+    const double d[3] = {g.dx, g.dy, g.dz};
+    int i0[3], i1[3];
+    for (int a = 0; a < 3; ++a) {
+        i0[a] = std::max(0, int(std::floor((lo[a] - min[a]) / d[a])));
+        i1[a] = std::min(n[a] - 1, int(std::floor((hi[a] - min[a]) / d[a])));
+        if (i0[a] > i1[a]) return occupancy;
+    }
+
+    // Threads take whole z-planes, as in MeshOccupancy
+    const float weight = 1.0f / float(s * s * s);
+    std::atomic<int> nextPlane{i0[2]};
+    auto work = [&]() {
+        for (int iz; (iz = nextPlane++) <= i1[2];) {
+            for (int iy = i0[1]; iy <= i1[1]; ++iy) {
+                float* row = &occupancy[size_t(g.NX) * (iy + size_t(g.NY) * iz)];
+                for (int ix = i0[0]; ix <= i1[0]; ++ix) {
+                    int count = 0;
+                    for (int kz = 0; kz < s; ++kz)
+                        for (int ky = 0; ky < s; ++ky)
+                            for (int kx = 0; kx < s; ++kx) {
+                                G4ThreeVector q(g.xmin + (ix + (kx + 0.5) / s) * g.dx,
+                                                g.ymin + (iy + (ky + 0.5) / s) * g.dy,
+                                                g.zmin + (iz + (kz + 0.5) / s) * g.dz);
+                                count += PrimitiveContains(p, q);
+                            }
+                    row[ix] = count * weight;
+                }
+            }
+        }
+    };
+
+    unsigned planes = unsigned(i1[2] - i0[2] + 1);
+    unsigned nThreads = std::max(1u, std::min(std::thread::hardware_concurrency(), planes));
+    std::vector<std::thread> pool;
+    for (unsigned w = 1; w < nThreads; ++w)
+        pool.emplace_back(work);
+    work();
+    for (auto& t : pool) t.join();
+    return occupancy;
+}
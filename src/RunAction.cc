@@ -4,13 +4,17 @@
  */
 
 #include "RunAction.hh"
+#include "DetectorConstruction.hh"
 #include "DoseVoxelGrid.hh"
 #include "GenVTI.hh"
+#include "PrimaryGeneratorAction.hh"
 #include "SceneConfig.hh"
 
 #include "G4Run.hh"
+#include "G4RunManager.hh"
 #include "G4SystemOfUnits.hh"
 
+#include <algorithm>
 #include <vector>
 #include <sstream>
 #include <utility>
@@ -21,6 +25,49 @@
 namespace {
 std::once_flag gGridInitFlag;
 std::atomic<bool> gIsFinalChunk{true};
+std::atomic<bool> gConverged{false};
+std::atomic<long long> gSimulatedEvents{0};
+std::atomic<double> gHistoryWeight{1.0};
+
+// Fraction of the convergence region whose relative uncertainty is at or
+// below target; region = voxels above the dose threshold (inside the ROI)
+double ConvergedFraction(const VoxelGrid& grid, const ConvergenceConfig& c,
+                         size_t& regionVoxels)
+{
+    regionVoxels = 0;
+    auto edep = grid.Energy();
+    auto unc  = grid.Uncertainty();
+    if (edep.empty() || unc.empty()) return 0.0;
+
+    float maxE = *std::max_element(edep.begin(), edep.end());
+    if (maxE <= 0.0f) return 0.0;
+    float threshold = static_cast<float>(c.dose_threshold) * maxE;
+
+    auto inRoi = [&](int i, float lo, float d, int axis) {
+        float center = lo + (i + 0.5f) * d;
+        return !c.has_roi || (center >= c.roi_min_mm[axis] && center <= c.roi_max_mm[axis]);
+    };
+
+    // The ROI is in each replica's own frame, so every replica is tested
+    size_t converged = 0;
+    size_t nVoxels = size_t(grid.NX) * grid.NY * grid.NZ;
+    for (int r = 0; r < grid.replicas; ++r) {
+        for (int iz = 0; iz < grid.NZ; ++iz) {
+            if (!inRoi(iz, grid.zmin, grid.dz, 2)) continue;
+            for (int iy = 0; iy < grid.NY; ++iy) {
+                if (!inRoi(iy, grid.ymin, grid.dy, 1)) continue;
+                for (int ix = 0; ix < grid.NX; ++ix) {
+                    if (!inRoi(ix, grid.xmin, grid.dx, 0)) continue;
+                    size_t idx = r * nVoxels + ix + size_t(grid.NX) * (iy + size_t(grid.NY) * iz);
+                    if (edep[idx] <= 0.0f || edep[idx] < threshold) continue;
+                    ++regionVoxels;
+                    if (unc[idx] <= c.target_rel_uncertainty) ++converged;
+                }
+            }
+        }
+    }
+    return regionVoxels ? double(converged) / regionVoxels : 0.0;
+}
 }
 
 RunAction::RunAction(const SceneConfig& cfg)
@@ -40,8 +87,14 @@ void RunAction::BeginOfRunAction(const G4Run* run)
     float dy = (2.0f * half) / NY;
     float dz = (2.0f * half) / NZ;
 
+    auto mode = VoxelGrid::ParseMode(config.voxel_grid.accumulation);
+
     std::call_once(gGridInitFlag, [&]() {
-        DoseVoxelGrid::Instance().Initialize(NX, NY, NZ, xmin, ymin, zmin, dx, dy, dz);
+        VoxelGrid::Create(config.voxel_grid.precision,
+                          NX, NY, NZ, xmin, ymin, zmin, dx, dy, dz, mode,
+                          config.voxel_grid.uncertainty,
+                          size_t(std::max(0, config.voxel_grid.batch)),
+                          int(config.instances_mm.size()));
     });
 
 }
@@ -49,22 +102,75 @@ void RunAction::BeginOfRunAction(const G4Run* run)
 void RunAction::EndOfRunAction(const G4Run* run)
 {
     if (!IsMaster()) return; // Only master writes output
-    if (!RunAction::IsFinalChunk()) return; // Only write after final chunk
 
-    auto& grid = DoseVoxelGrid::Instance();
+    gSimulatedEvents += run->GetNumberOfEvent();
+    auto& grid = VoxelGrid::Instance();
+
+    // Between chunks: merge what the workers have so far and test it
+    const auto& conv = config.convergence;
+    if (conv.enabled && !RunAction::IsFinalChunk()) {
+        grid.Merge(false);
+        size_t regionVoxels = 0;
+        double frac = ConvergedFraction(grid, conv, regionVoxels);
+        G4cout << "Convergence: " << gSimulatedEvents.load() << " events, "
+               << 100.0 * frac << "% of " << regionVoxels
+               << " region voxels at <= " << conv.target_rel_uncertainty
+               << " relative uncertainty" << G4endl;
+        if (regionVoxels > 0 && frac >= conv.coverage)
+            gConverged.store(true);
+    }
+
+    // Only write after final chunk (or once converged)
+    if (!RunAction::IsFinalChunk() && !RunAction::IsConverged()) return;
+
+    // Workers are done: fold their private grids into the master grid
+    grid.Merge();
+
+    // Weighted histories (or a convergence stop): each simulated photon
+    // stands for physical / simulated photons of flux * exposure. Otherwise
+    // only undo the round-up to whole photon batches, so the tallies match
+    // the photon count asked for
+    const int photonsPerEvent = config.beam.photons_per_event;
+    double simulated = static_cast<double>(gSimulatedEvents.load()) * photonsPerEvent;
+    double physical  = config.beam.photon_flux_per_s * config.beam.exposure_time_s;
+    double target    = static_cast<double>(config.acquisition.target_photons);
+    double weight = 1.0;
+    bool weighted = conv.enabled || config.beam.histories > 0;
+    if (weighted && simulated > 0.0 && physical > 0.0)
+        weight = physical / simulated;
+    else if (!weighted && photonsPerEvent > 1 && simulated > 0.0 && target > 0.0)
+        weight = target / simulated;
+    gHistoryWeight.store(weight);
 
     // Collect metadata for .vti file 
     std::vector<std::pair<std::string, std::string>> meta;
     
     meta.emplace_back("material_formula", 
-            config.object.material.formula);
+            config.objects.front().material.formula);
     
     meta.emplace_back("material_density_g_cm3", 
-            std::to_string(config.object.material.density_g_cm3));
+            std::to_string(config.objects.front().material.density_g_cm3));
     
     meta.emplace_back("beam_mono_energy_keV", 
             std::to_string(config.beam.mono_energy_keV));
     
+    // Spectrum summary: lines, range and intensity-weighted mean energy
+    const auto& spectrum = config.beam.spectrum_keV;
+    if (!spectrum.empty()) {
+        double total = 0.0, mean = 0.0;
+        for (size_t i = 0; i < spectrum.size(); ++i) {
+            total += config.beam.spectrum_weight[i];
+            mean += config.beam.spectrum_weight[i] * spectrum[i];
+        }
+        meta.emplace_back("beam_spectrum_source", config.beam.spectrum_source);
+        meta.emplace_back("beam_spectrum_lines", std::to_string(spectrum.size()));
+        meta.emplace_back("beam_spectrum_min_keV",
+                std::to_string(*std::min_element(spectrum.begin(), spectrum.end())));
+        meta.emplace_back("beam_spectrum_max_keV",
+                std::to_string(*std::max_element(spectrum.begin(), spectrum.end())));
+        meta.emplace_back("beam_spectrum_mean_keV", std::to_string(mean / total));
+    }
+
     meta.emplace_back("beam_photon_flux_per_s", 
             std::to_string(config.beam.photon_flux_per_s));
     
@@ -72,16 +178,115 @@ void RunAction::EndOfRunAction(const G4Run* run)
             std::to_string(config.beam.exposure_time_s));
     
     meta.emplace_back("simulated_events", 
-            std::to_string(config.acquisition.total_events));
+            std::to_string(gSimulatedEvents.load()));
+
+    meta.emplace_back("photons_per_event",
+            std::to_string(photonsPerEvent));
+
+    meta.emplace_back("culled_primaries",
+            std::to_string(PrimaryGeneratorAction::CulledPrimaries()));
+
+    meta.emplace_back("physical_photons",
+            std::to_string(physical));
+
+    meta.emplace_back("history_weight",
+            std::to_string(weight));
+
+    meta.emplace_back("accumulator_precision",
+            grid.Precision());
+
+    meta.emplace_back("scoring",
+            config.voxel_grid.scoring);
 
-    std::filesystem::path outPath = std::filesystem::path(config.output_dir) / "dose.vti";
+    meta.emplace_back("replicas",
+            std::to_string(grid.replicas));
 
-    VTIWriter::Write(outPath.string(),
-                     grid.Data(),
-                     grid.NX, grid.NY, grid.NZ,
-                     grid.xmin, grid.ymin, grid.zmin,
-                     grid.dx, grid.dy, grid.dz,
-                     meta);
+    std::string ids;
+    for (size_t i = 0; i < config.objects.size(); ++i)
+        ids += (i ? "," : "") + config.objects[i].id;
+    meta.emplace_back("objects", ids);
+
+    // Float grids are written straight from the master grid; other
+    // precisions need one float copy
+    std::vector<float> energyCopy;
+    const float* energy = grid.EnergyData();
+    if (!energy) {
+        energyCopy = grid.Energy();
+        energy = energyCopy.data();
+    }
+    std::vector<float> uncertainty;
+    if (grid.uncertainty) {
+        uncertainty = grid.Uncertainty();
+        meta.emplace_back("scored_histories", std::to_string(grid.histories));
+    }
+
+    // Partial-volume fractions and the voxel mass they imply; the same for
+    // every replica
+    auto* detector = static_cast<const DetectorConstruction*>(
+        G4RunManager::GetRunManager()->GetUserDetectorConstruction());
+    size_t nVoxels = size_t(grid.NX) * grid.NY * grid.NZ;
+    bool occupancy = detector && detector->Occupancy().size() == nVoxels;
+    if (occupancy) {
+        double mass = 0.0;
+        for (float m : detector->VoxelMass()) mass += m;
+        meta.emplace_back("model_mass_g", std::to_string(mass));
+    }
+
+    // One map per instanced sample, in the sample's own frame and placed at
+    // its offset; a single sample keeps the plain dose.vti name
+    size_t nObjects = config.objects.size();
+    for (int r = 0; r < grid.replicas; ++r) {
+        const auto& offset = config.instances_mm[r];
+        auto replicaMeta = meta;
+        replicaMeta.emplace_back("replica", std::to_string(r));
+        std::ostringstream os;
+        os << offset[0] << "," << offset[1] << "," << offset[2];
+        replicaMeta.emplace_back("replica_offset_mm", os.str());
+
+        // edep_keV stays first: post-processing scripts read the first array
+        // Fields point into the grids; the weight is applied while writing
+        std::vector<VTIField> fields;
+        fields.push_back({"edep_keV", energy + r * nVoxels, nVoxels, static_cast<float>(weight)});
+        if (!uncertainty.empty())
+            fields.push_back({"edep_rel_uncertainty", uncertainty.data() + r * nVoxels, nVoxels});
+        if (occupancy) {
+            fields.push_back({"occupancy", detector->Occupancy().data(), nVoxels});
+            fields.push_back({"mass_g", detector->VoxelMass().data(), nVoxels});
+        }
+
+        // Per-object tallies: energy, mass from the mesh volume, mean dose
+        for (size_t i = 0; i < nObjects; ++i) {
+            const auto& obj = config.objects[i];
+            size_t tally = r * nObjects + i;
+            double edep = tally < grid.objectEnergy.size() ? grid.objectEnergy[tally] * weight : 0.0;
+            double mass_g = 0.0;
+            if (detector && i < detector->ObjectVolumes().size())
+                mass_g = detector->ObjectVolumes()[i] * 1e-3 * obj.material.density_g_cm3;
+            double dose = mass_g > 0.0 ? edep * keV / joule / (mass_g * 1e-3) : 0.0;
+
+            std::string prefix = "object_" + obj.id + "_";
+            replicaMeta.emplace_back(prefix + "material", obj.material.formula);
+            replicaMeta.emplace_back(prefix + "edep_keV", std::to_string(edep));
+            replicaMeta.emplace_back(prefix + "mass_g", std::to_string(mass_g));
+            replicaMeta.emplace_back(prefix + "dose_Gy", std::to_string(dose));
+            G4cout << "Object " << obj.id;
+            if (grid.replicas > 1) G4cout << " [" << r << "]";
+            G4cout << ": " << edep << " keV in " << mass_g
+                   << " g -> " << dose << " Gy" << G4endl;
+        }
+
+        std::string name = grid.replicas > 1 ? "dose_" + std::to_string(r) + ".vti" : "dose.vti";
+        std::filesystem::path outPath = std::filesystem::path(config.output_dir) / name;
+
+        VTIWriter::Write(outPath.string(),
+                         fields,
+                         grid.NX, grid.NY, grid.NZ,
+                         grid.xmin + float(offset[0]),
+                         grid.ymin + float(offset[1]),
+                         grid.zmin + float(offset[2]),
+                         grid.dx, grid.dy, grid.dz,
+                         replicaMeta);
+    }
 }
 
 void RunAction::SetIsFinalChunk(bool v)
@@ -93,3 +298,18 @@ bool RunAction::IsFinalChunk()
 {
     return gIsFinalChunk.load();
 }
+
+bool RunAction::IsConverged()
+{
+    return gConverged.load();
+}
+
+long long RunAction::SimulatedEvents()
+{
+    return gSimulatedEvents.load();
+}
+
+double RunAction::HistoryWeight()
+{
+    return gHistoryWeight.load();
+}
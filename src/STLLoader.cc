@@ -0,0 +1,189 @@
+/*
+ * src/STLLoader.cc
+ * Memory-mapped, multithreaded STL reader
+ */
+
+#include "STLLoader.hh"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+struct Bounds {
+    float lo[3] = {std::numeric_limits<float>::max(), std::numeric_limits<float>::max(),
+                   std::numeric_limits<float>::max()};
+    float hi[3] = {std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(),
+                   std::numeric_limits<float>::lowest()};
+
+    void Add(const float* v)
+    {
+        for (int a = 0; a < 3; ++a) {
+            lo[a] = std::min(lo[a], v[a]);
+            hi[a] = std::max(hi[a], v[a]);
+        }
+    }
+    void Add(const Bounds& o)
+    {
+        Add(o.lo);
+        Add(o.hi);
+    }
+};
+
+// Unit normal from the winding; the normals stored in STL files are often
+// zero or stale, so they are not trusted
+void FaceNormal(const float* v, float* n)
+{
+    float e1[3] = {v[3] - v[0], v[4] - v[1], v[5] - v[2]};
+    float e2[3] = {v[6] - v[0], v[7] - v[1], v[8] - v[2]};
+    n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+    float len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    float inv = len > 0.0f ? 1.0f / len : 0.0f;
+    for (int a = 0; a < 3; ++a) n[a] *= inv;
+}
+
+bool ParseBinary(const char* data, size_t size, STLMesh& mesh, Bounds& bounds)
+{
+    uint32_t n = 0;
+    std::memcpy(&n, data + 80, sizeof(n));
+    if (size < 84 + size_t(n) * 50) return false;
+
+    mesh.vertices.resize(size_t(n) * 9);
+    mesh.normals.resize(size_t(n) * 3);
+
+    // Each worker copies a contiguous run of 50-byte records
+    size_t nThreads = std::max(1u, std::thread::hardware_concurrency());
+    nThreads = std::min<size_t>(nThreads, n / 65536 + 1);
+    std::vector<Bounds> partial(nThreads);
+    auto parse = [&](size_t w) {
+        size_t begin = n * w / nThreads, end = n * (w + 1) / nThreads;
+        for (size_t i = begin; i < end; ++i) {
+            float* v = &mesh.vertices[9 * i];
+            // Skip the stored normal (12 bytes) and the attribute (2 bytes)
+            std::memcpy(v, data + 84 + 50 * i + 12, 9 * sizeof(float));
+            FaceNormal(v, &mesh.normals[3 * i]);
+            for (int k = 0; k < 3; ++k) partial[w].Add(v + 3 * k);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (size_t w = 1; w < nThreads; ++w)
+        pool.emplace_back(parse, w);
+    parse(0);
+    for (auto& t : pool) t.join();
+
+    for (auto& b : partial) bounds.Add(b);
+    return n > 0;
+}
+
+bool ParseASCII(const char* data, size_t size, STLMesh& mesh, Bounds& bounds)
+{
+    const char* p = data;
+    const char* end = data + size;
+    float tri[9];
+    int corner = 0;
+    while (p < end) {
+        const char* hit = static_cast<const char*>(memmem(p, size_t(end - p), "vertex", 6));
+        if (!hit) break;
+        p = hit + 6;
+        for (int a = 0; a < 3; ++a) {
+            while (p < end && std::isspace(static_cast<unsigned char>(*p))) ++p;
+            auto res = std::from_chars(p, end, tri[3 * corner + a]);
+            if (res.ec != std::errc()) return false;
+            p = res.ptr;
+        }
+        if (++corner == 3) {
+            corner = 0;
+            mesh.vertices.insert(mesh.vertices.end(), tri, tri + 9);
+            float n[3];
+            FaceNormal(tri, n);
+            mesh.normals.insert(mesh.normals.end(), n, n + 3);
+            for (int k = 0; k < 3; ++k) bounds.Add(tri + 3 * k);
+        }
+    }
+    return !mesh.normals.empty();
+}
+}
+
+MappedFile::MappedFile(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            data = static_cast<const char*>(p);
+            size = size_t(st.st_size);
+            madvise(p, size, MADV_SEQUENTIAL);
+        }
+    }
+    close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (data) munmap(const_cast<char*>(data), size);
+}
+
+void STLMesh::Scale(double scale)
+{
+    const float s = float(scale);
+    for (auto& v : vertices) v *= s;
+    min *= scale;
+    max *= scale;
+}
+
+std::vector<G4ThreeVector> STLMesh::Corners(double scale) const
+{
+    std::vector<G4ThreeVector> out(vertices.size() / 3);
+    for (size_t i = 0; i < out.size(); ++i)
+        out[i] = G4ThreeVector(vertices[3 * i], vertices[3 * i + 1], vertices[3 * i + 2]) * scale;
+    return out;
+}
+
+STLMesh LoadSTL(const std::string& path)
+{
+    STLMesh mesh;
+    MappedFile file(path);
+    if (!file.data || file.size < 84) return mesh;
+
+    // ASCII files start with "solid", but so do some binary headers, and
+    // binary files may carry trailing bytes after the records. An exact
+    // size match or another header means binary first; a "solid" header
+    // means ASCII first, then binary if the records fit in the file
+    Bounds bounds;
+    uint32_t n = 0;
+    std::memcpy(&n, file.data + 80, sizeof(n));
+    bool binarySize = file.size == 84 + size_t(n) * 50;
+    bool asciiHeader = std::strncmp(file.data, "solid", 5) == 0;
+    bool asciiFirst = asciiHeader && !binarySize;
+
+    auto reset = [&]() {
+        mesh.vertices.clear();
+        mesh.normals.clear();
+        bounds = Bounds();
+    };
+    for (int attempt = 0; attempt < 2 && !mesh.ok; ++attempt) {
+        reset();
+        bool ascii = (attempt == 0) == asciiFirst;
+        mesh.ok = ascii ? ParseASCII(file.data, file.size, mesh, bounds)
+                        : ParseBinary(file.data, file.size, mesh, bounds);
+    }
+    if (mesh.ok) {
+        mesh.min = G4ThreeVector(bounds.lo[0], bounds.lo[1], bounds.lo[2]);
+        mesh.max = G4ThreeVector(bounds.hi[0], bounds.hi[1], bounds.hi[2]);
+    }
+    return mesh;
+}
@@ -6,11 +6,36 @@
 #include "SceneConfig.hh"
 #include "json.hpp"
 
+#include <algorithm>
 #include <fstream>
 #include <filesystem>
+#include <sstream>
+#include <stdexcept>
 
 using json = nlohmann::json;
 
+namespace {
+// Two columns per line: energy in keV and relative weight (commas or
+// whitespace between them, '#' starts a comment)
+void ReadSpectrumFile(const std::filesystem::path& path, BeamConfig& beam)
+{
+    std::ifstream in(path);
+    if (!in)
+        throw std::runtime_error("Cannot read spectrum " + path.string());
+    std::string line;
+    while (std::getline(in, line)) {
+        line = line.substr(0, line.find('#'));
+        std::replace(line.begin(), line.end(), ',', ' ');
+        std::istringstream is(line);
+        double e, w;
+        if (is >> e >> w) {
+            beam.spectrum_keV.push_back(e);
+            beam.spectrum_weight.push_back(w);
+        }
+    }
+}
+}
+
 SceneConfig SceneConfig::Load(const std::string& path)
 {
     std::filesystem::path cfgPath = std::filesystem::absolute(path);
@@ -42,31 +67,105 @@ SceneConfig SceneConfig::Load(const std::string& path)
                                     jb["detector_pixels"][1] };
     cfg.beam.detector_pixel_size_mm = { jb["detector_pixel_size_mm"][0],
                                         jb["detector_pixel_size_mm"][1] };
-    cfg.beam.mono_energy_keV    = jb["mono_energy_keV"];
+    // Polychromatic beam: inline [[keV, weight], ...] or a two-column file
+    if (jb.contains("spectrum")) {
+        auto js = jb["spectrum"];
+        if (js.is_string()) {
+            std::filesystem::path spectrumPath = js.get<std::string>();
+            if (spectrumPath.is_relative()) {
+                std::filesystem::path candidate = cfgDir / spectrumPath;
+                if (!std::filesystem::exists(candidate))
+                    candidate = cfgDir.parent_path() / spectrumPath;
+                spectrumPath = candidate;
+            }
+            ReadSpectrumFile(spectrumPath, cfg.beam);
+            cfg.beam.spectrum_source = spectrumPath.string();
+        } else {
+            for (const auto& line : js) {
+                cfg.beam.spectrum_keV.push_back(line[0]);
+                cfg.beam.spectrum_weight.push_back(line[1]);
+            }
+            cfg.beam.spectrum_source = "inline";
+        }
+        double total = 0.0, mean = 0.0;
+        for (size_t i = 0; i < cfg.beam.spectrum_keV.size(); ++i) {
+            if (cfg.beam.spectrum_keV[i] <= 0.0 || cfg.beam.spectrum_weight[i] < 0.0)
+                throw std::runtime_error("Invalid spectrum line in " + cfgPath.string());
+            total += cfg.beam.spectrum_weight[i];
+            mean += cfg.beam.spectrum_weight[i] * cfg.beam.spectrum_keV[i];
+        }
+        if (total <= 0.0)
+            throw std::runtime_error("Spectrum has no intensity: " + cfg.beam.spectrum_source);
+        cfg.beam.mono_energy_keV = jb.value("mono_energy_keV", mean / total);
+    } else {
+        cfg.beam.mono_energy_keV = jb["mono_energy_keV"];
+    }
     cfg.beam.photon_flux_per_s  = jb["photon_flux_per_s"];
     cfg.beam.exposure_time_s    = jb.value("exposure_time_s", 1.0);
+    cfg.beam.histories          = static_cast<long long>(jb.value("histories", 0.0));
+    cfg.beam.footprint          = jb.value("footprint", cfg.beam.footprint);
+    cfg.beam.photons_per_event  = std::max(1, jb.value("photons_per_event", cfg.beam.photons_per_event));
+
+    // Objects share one fit to the voxel cube, so meshes exported from the
+    // same CAD scene keep their relative placement; primitives ("shape")
+    // are given in mm and keep their size
+    for (const auto& jo : j["objects"]) {
+        ObjectConfig obj;
+        obj.id = jo["id"];
+        if (jo.contains("shape")) {
+            auto js = jo["shape"];
+            auto& p = obj.primitive;
+            p.type      = js["type"];
+            p.radius_mm = js.value("radius_mm", p.radius_mm);
+            p.length_mm = js.value("length_mm", p.length_mm);
+            p.wall_mm   = js.value("wall_mm", p.wall_mm);
+            if (js.contains("size_mm"))
+                p.size_mm = { js["size_mm"][0], js["size_mm"][1], js["size_mm"][2] };
+            if (js.contains("position_mm"))
+                p.position_mm = { js["position_mm"][0], js["position_mm"][1], js["position_mm"][2] };
+            std::string axis = js.value("axis", "z");
+            p.axis = axis.empty() ? 'z' : axis[0];
 
-    // Only one object in setup.JSON
-    auto jo = j["objects"][0];
-    cfg.object.id        = jo["id"];
-    std::filesystem::path meshPath = jo["mesh_path"].get<std::string>();
-    if (meshPath.is_relative()) {
-        std::filesystem::path configDir = cfgPath.parent_path();
-        std::filesystem::path candidate = configDir / meshPath;
-        if (!std::filesystem::exists(candidate)) {
-            // Fallback: allow data/ to stay at project root
-            std::filesystem::path projectRoot = configDir.parent_path();
-            candidate = projectRoot / meshPath;
+            bool ok = p.axis == 'x' || p.axis == 'y' || p.axis == 'z';
+            double minHalf = 0.0;
+            if (p.type == "box") {
+                minHalf = 0.5 * std::min({p.size_mm[0], p.size_mm[1], p.size_mm[2]});
+            } else if (p.type == "cylinder" || p.type == "capillary") {
+                minHalf = std::min(p.radius_mm, p.type == "cylinder" ? 0.5 * p.length_mm : p.radius_mm);
+                ok = ok && p.length_mm > 0.0 && (p.type == "cylinder" || p.wall_mm > 0.0);
+            } else if (p.type == "sphere") {
+                minHalf = p.radius_mm;
+            } else {
+                ok = false;
+            }
+            if (!ok || minHalf <= 0.0 || p.wall_mm < 0.0 || p.wall_mm >= minHalf)
+                throw std::runtime_error("Invalid shape for object " + obj.id + ": " + cfgPath.string());
+        } else {
+            std::filesystem::path meshPath = jo["mesh_path"].get<std::string>();
+            if (meshPath.is_relative()) {
+                std::filesystem::path configDir = cfgPath.parent_path();
+                std::filesystem::path candidate = configDir / meshPath;
+                if (!std::filesystem::exists(candidate)) {
+                    // Fallback: allow data/ to stay at project root
+                    std::filesystem::path projectRoot = configDir.parent_path();
+                    candidate = projectRoot / meshPath;
+                }
+                meshPath = candidate;
+            }
+            obj.mesh_path = meshPath.string();
         }
-        meshPath = candidate;
-    }
-    cfg.object.mesh_path = meshPath.string();
-    cfg.object.units     = jo.value("units", "mm");
+        obj.units      = jo.value("units", "mm");
+        obj.geometry   = jo.value("geometry", obj.geometry);
+        obj.mesh_cache = jo.value("mesh_cache", obj.mesh_cache);
 
-    auto jm = jo["material"];
-    cfg.object.material.formula        = jm["formula"];
-    cfg.object.material.density_g_cm3  = jm["density_g_cm3"];
-    cfg.object.material.cp_J_kgK       = jm["cp_J_kgK"];
+        auto jm = jo["material"];
+        obj.material.formula        = jm["formula"];
+        obj.material.density_g_cm3  = jm["density_g_cm3"];
+        obj.material.cp_J_kgK       = jm["cp_J_kgK"];
+        cfg.objects.push_back(obj);
+    }
+    if (cfg.objects.empty())
+        throw std::runtime_error("Config has no objects: " + cfgPath.string());
 
     // Voxel grid config to keep Geant and ParaView in sync
     if (j.contains("voxel_grid")) {
@@ -77,6 +176,44 @@ SceneConfig SceneConfig::Load(const std::string& path)
             cfg.voxel_grid.nz = jvg["counts"][2];
         }
         cfg.voxel_grid.half_size_mm = jvg.value("half_size_mm", cfg.voxel_grid.half_size_mm);
+        cfg.voxel_grid.accumulation = jvg.value("accumulation", cfg.voxel_grid.accumulation);
+        cfg.voxel_grid.precision    = jvg.value("precision", cfg.voxel_grid.precision);
+        cfg.voxel_grid.uncertainty  = jvg.value("uncertainty", cfg.voxel_grid.uncertainty);
+        cfg.voxel_grid.batch        = jvg.value("batch", cfg.voxel_grid.batch);
+        cfg.voxel_grid.scoring      = jvg.value("scoring", cfg.voxel_grid.scoring);
+        cfg.voxel_grid.deposit      = jvg.value("deposit", cfg.voxel_grid.deposit);
+        cfg.voxel_grid.occupancy_samples = jvg.value("occupancy_samples", cfg.voxel_grid.occupancy_samples);
+    }
+
+    // Instanced samples: explicit offsets, or a lattice centred on the origin
+    if (j.contains("instances")) {
+        auto ji = j["instances"];
+        cfg.instances_mm.clear();
+        if (ji.contains("positions_mm")) {
+            for (const auto& p : ji["positions_mm"])
+                cfg.instances_mm.push_back({ p[0], p[1], p[2] });
+        } else if (ji.contains("lattice")) {
+            auto jl = ji["lattice"];
+            std::array<int,3> n = { jl["counts"][0], jl["counts"][1], jl["counts"][2] };
+            std::array<double,3> pitch = { jl["pitch_mm"][0], jl["pitch_mm"][1], jl["pitch_mm"][2] };
+            for (int k = 0; k < n[2]; ++k)
+                for (int jj = 0; jj < n[1]; ++jj)
+                    for (int i = 0; i < n[0]; ++i)
+                        cfg.instances_mm.push_back({ (i - 0.5 * (n[0] - 1)) * pitch[0],
+                                                     (jj - 0.5 * (n[1] - 1)) * pitch[1],
+                                                     (k - 0.5 * (n[2] - 1)) * pitch[2] });
+        }
+        if (cfg.instances_mm.empty())
+            throw std::runtime_error("Config \"instances\" has no positions: " + cfgPath.string());
+    }
+
+    // Production cuts and the kill zone outside the scoring envelope
+    if (j.contains("physics")) {
+        auto jp = j["physics"];
+        cfg.physics.cut_mm       = jp.value("cut_mm", cfg.physics.cut_mm);
+        cfg.physics.world_cut_mm = jp.value("world_cut_mm", cfg.physics.world_cut_mm);
+        cfg.physics.kill_outside = jp.value("kill_outside", cfg.physics.kill_outside);
+        cfg.physics.cull_primaries = jp.value("cull_primaries", cfg.physics.cull_primaries);
     }
 
     // Acquisition / rotation setup
@@ -86,6 +223,7 @@ SceneConfig SceneConfig::Load(const std::string& path)
         cfg.acquisition.num_projections = ja.value("num_projections", cfg.acquisition.num_projections);
         cfg.acquisition.start_angle_deg = ja.value("start_angle_deg", cfg.acquisition.start_angle_deg);
         cfg.acquisition.end_angle_deg   = ja.value("end_angle_deg", cfg.acquisition.end_angle_deg);
+        cfg.acquisition.fly_step_deg    = ja.value("fly_step_deg", cfg.acquisition.fly_step_deg);
         if (ja.contains("rotation_axis")) {
             cfg.acquisition.rotation_axis = { ja["rotation_axis"][0],
                                                ja["rotation_axis"][1],
@@ -98,5 +236,22 @@ SceneConfig SceneConfig::Load(const std::string& path)
         }
     }
 
+    // Convergence-controlled stopping
+    if (j.contains("convergence")) {
+        auto jc = j["convergence"];
+        auto& c = cfg.convergence;
+        c.target_rel_uncertainty = jc.value("target_rel_uncertainty", c.target_rel_uncertainty);
+        c.dose_threshold     = jc.value("dose_threshold", c.dose_threshold);
+        c.coverage           = jc.value("coverage", c.coverage);
+        c.check_every_events = jc.value("check_every_events", c.check_every_events);
+        c.max_events         = static_cast<long long>(jc.value("max_events", 0.0));
+        if (jc.contains("roi_min_mm") && jc.contains("roi_max_mm")) {
+            c.has_roi = true;
+            c.roi_min_mm = { jc["roi_min_mm"][0], jc["roi_min_mm"][1], jc["roi_min_mm"][2] };
+            c.roi_max_mm = { jc["roi_max_mm"][0], jc["roi_max_mm"][1], jc["roi_max_mm"][2] };
+        }
+        c.enabled = c.target_rel_uncertainty > 0.0;
+    }
+
     return cfg;
 }
@@ -91,15 +91,41 @@ int main(int argc, char **argv) {
   long long targetEvents = 0;
   if (cliEvents.has_value()) {
     targetEvents = *cliEvents;
+  } else if (cfg.beam.histories > 0) {
+    // Weighted histories: each carries totalPhotons / histories photons
+    targetEvents = cfg.beam.histories;
   } else {
     auto suggested = static_cast<long long>(std::llround(totalPhotons));
     if (suggested > 0) {
       targetEvents = suggested;
     }
   }
+
+  // Convergence mode: targetEvents becomes an upper bound and the loop runs
+  // in check_every_events chunks, each spread over all projection angles
+  auto &conv = cfg.convergence;
+  if (conv.enabled && (!cfg.voxel_grid.uncertainty ||
+                       cfg.voxel_grid.accumulation != "thread_local")) {
+    std::cerr << "convergence needs voxel_grid.uncertainty with thread_local "
+                 "accumulation; running fixed event count\n";
+    conv.enabled = false;
+  }
+  if (conv.enabled) {
+    if (!cliEvents.has_value() && conv.max_events > 0)
+      targetEvents = std::min(targetEvents, conv.max_events);
+    cfg.acquisition.interleave = true;
+  }
+
   if (targetEvents < 0)
     targetEvents = 0;
+
+  // The counts above are photons; each Geant4 event carries
+  // photons_per_event of them (the last one may overshoot the target)
+  const long long photonsPerEvent = cfg.beam.photons_per_event;
+  long long targetPhotons = targetEvents;
+  targetEvents = (targetPhotons + photonsPerEvent - 1) / photonsPerEvent;
   cfg.acquisition.total_events = targetEvents;
+  cfg.acquisition.target_photons = targetPhotons;
 
   // Create run manager
   auto *runManager =
@@ -116,7 +142,7 @@ int main(int argc, char **argv) {
 
   // User initializations
   runManager->SetUserInitialization(new DetectorConstruction(cfg));
-  runManager->SetUserInitialization(new PhysicsList());
+  runManager->SetUserInitialization(new PhysicsList(cfg.physics));
   runManager->SetUserInitialization(new ActionInitialization(cfg));
 
   // Initialize Geant4 kernel
@@ -130,10 +156,14 @@ int main(int argc, char **argv) {
       chunkSize = std::min(requested, maxG4Events);
     }
   }
+  if (conv.enabled && conv.check_every_events > 0) {
+    chunkSize = std::min(chunkSize, std::max(1LL, conv.check_every_events / photonsPerEvent));
+  }
   if (targetEvents > 0 && chunkSize > targetEvents) {
     chunkSize = targetEvents;
   }
 
+  auto loopStart = std::chrono::steady_clock::now();
   long long eventOffset = 0;
   if (targetEvents <= 0) {
     RunAction::SetIsFinalChunk(true);
@@ -141,7 +171,7 @@ int main(int argc, char **argv) {
     runManager->BeamOn(0);
   } else {
     int chunkIndex = 0;
-    while (eventOffset < targetEvents) {
+    while (eventOffset < targetEvents && !RunAction::IsConverged()) {
       long long remaining = targetEvents - eventOffset;
       auto thisChunk =
           static_cast<G4int>(std::min<long long>(chunkSize, remaining));
@@ -154,6 +184,9 @@ int main(int argc, char **argv) {
   }
 
   auto programEnd = std::chrono::steady_clock::now();
+  double loop_s = std::chrono::duration_cast<std::chrono::duration<double>>(
+                      programEnd - loopStart)
+                      .count();
   double total_s = std::chrono::duration_cast<std::chrono::duration<double>>(
                        programEnd - programStart)
                        .count();
@@ -161,13 +194,38 @@ int main(int argc, char **argv) {
   // Info on the run
   std::cout << " --- Energy --- \n \n";
   std::cout << "Total time           : " << total_s << " s\n";
+  std::cout << "Event loop time      : " << loop_s << " s\n";
   std::cout << "Threads              : " << nThreads << "\n";
-  std::cout << "Events               : " << targetEvents << "\n";
+  long long simulatedEvents = RunAction::SimulatedEvents();
+  long long simulatedPhotons = simulatedEvents * photonsPerEvent;
+  std::cout << "Events               : " << simulatedEvents << " ("
+            << photonsPerEvent << " photons each)\n";
+  long long culledPrimaries = PrimaryGeneratorAction::CulledPrimaries();
+  std::cout << "Culled primaries     : " << culledPrimaries << " ("
+            << (simulatedPhotons > 0 ? 100.0 * culledPrimaries / simulatedPhotons : 0.0)
+            << "% missed the scoring region)\n";
+  if (conv.enabled) {
+    std::cout << "Convergence          : "
+              << (RunAction::IsConverged() ? "reached" : "not reached")
+              << " (target " << conv.target_rel_uncertainty << ", max "
+              << targetPhotons << " photons)\n";
+  }
+  std::cout << "Event rate           : "
+            << (loop_s > 0.0 ? simulatedEvents / loop_s : 0.0) << " events/s, "
+            << (loop_s > 0.0 ? simulatedPhotons / loop_s : 0.0) << " photons/s\n";
   // std::cout << "Flux                 : " << cfg.beam.photon_flux_per_s
-  std::cout << "Flux                 : " << targetEvents << " ph/s\n";
+  std::cout << "Flux                 : " << targetPhotons << " ph/s\n";
   std::cout << "Exposure time        : " << cfg.beam.exposure_time_s << " s\n";
-  std::cout << "Energy               : " << cfg.beam.mono_energy_keV
-            << " keV\n";
+  std::cout << "History weight       : " << RunAction::HistoryWeight()
+            << " photons/history\n";
+  if (cfg.beam.spectrum_keV.empty()) {
+    std::cout << "Energy               : " << cfg.beam.mono_energy_keV
+              << " keV\n";
+  } else {
+    std::cout << "Energy               : spectrum, "
+              << cfg.beam.spectrum_keV.size() << " lines from "
+              << cfg.beam.spectrum_source << "\n";
+  }
   std::cout << "Detector             : " << cfg.beam.detector_pixels[0] << "x"
             << cfg.beam.detector_pixels[1] << " px @ "
             << cfg.beam.detector_pixel_size_mm[0] << "x"
@@ -180,7 +238,9 @@ int main(int argc, char **argv) {
             << cfg.voxel_grid.ny << "x"
             << cfg.voxel_grid.nz
             // << " in a cube half-size " << cfg.voxel_grid.half_size_mm
-            << " mm\n";
+            << " mm (" << cfg.voxel_grid.accumulation << ", "
+            << cfg.voxel_grid.precision << ", "
+            << cfg.voxel_grid.scoring << ")\n";
   std::cout << "\n";
   std::cout << "Output               : " << cfg.output_dir << "\n";
 